@@ -0,0 +1,100 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CollisionLibrary.hpp"
+#include "GenerateMany.hpp"
+
+// Scaling of GenerateMany with the number of threads (1, 2, 4, ... up to the cores),
+// with the library read from the DB file by every worker and shared in memory.
+// The tracks must be the same for every number of threads.
+
+namespace
+{
+    bool Same(const std::vector<TrackGeneratorB::CollisionCollection> &_l,
+              const std::vector<TrackGeneratorB::CollisionCollection> &_r)
+    {
+        if (_l.size() != _r.size())
+            return false;
+        for (std::size_t t = 0; t < _l.size(); ++t)
+        {
+            if (_l[t].size() != _r[t].size())
+                return false;
+            for (std::size_t i = 0; i < _l[t].size(); ++i)
+            {
+                const auto a = _l[t][i].GetPosition(), b = _r[t][i].GetPosition();
+                if (a.X() != b.X() || a.Y() != b.Y() || a.Z() != b.Z())
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool Run(const std::string &_source, const TrackGeneratorB &_prototype,
+             std::size_t _nTracks, double _ekin, int _maxThreads)
+    {
+        std::cout << _source << std::endl;
+        bool good = true;
+        double t1 = 0;
+        std::vector<TrackGeneratorB::CollisionCollection> reference;
+        for (int nThreads = 1;; nThreads = std::min(2 * nThreads, _maxThreads))
+        {
+            const auto start = std::chrono::steady_clock::now();
+            auto tracks = GenerateMany(_prototype, _nTracks, _ekin, 0, 0, 0, 1, 0, 0, nThreads);
+            const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            bool same = true;
+            if (nThreads == 1)
+            {
+                reference = std::move(tracks);
+                t1 = sec;
+            }
+            else
+            {
+                same = Same(reference, tracks);
+                good = good && same;
+            }
+            std::cout << "   " << nThreads << " threads : " << sec << " s, speed-up " << t1 / sec
+                      << ", efficiency " << t1 / sec / nThreads
+                      << (same ? "" : " (tracks DIFFER from 1 thread)") << std::endl;
+            if (nThreads == _maxThreads)
+                break;
+        }
+        return good;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << argv[0] << " [library] [energy_eV] ([tracks]) ([max_threads])" << std::endl;
+        return 1;
+    }
+    const std::string library = argv[1];
+    const double ekin = std::atof(argv[2]);
+    const std::size_t nTracks = argc > 3 ? std::atol(argv[3]) : 2000;
+    int maxThreads = argc > 4 ? std::atoi(argv[4]) : int(std::thread::hardware_concurrency());
+    if (maxThreads < 1)
+        maxThreads = 1;
+
+    TrackGeneratorB file(library);
+    if (!file.IsAccesible())
+    {
+        std::cerr << "Cannot read " << library << std::endl;
+        return 1;
+    }
+    file.SetSeed(1);
+    bool good = Run("DB file (one connection per worker)", file, nTracks, ekin, maxThreads);
+
+    TrackGeneratorB memory;
+    memory.SetLibrary(CollisionLibrary::Open(library));
+    memory.SetSeed(1);
+    good = Run("Library in memory (CollisionLibrary)", memory, nTracks, ekin, maxThreads) && good;
+
+    std::cout << (good ? "OK" : "FAILED") << " : same tracks for every number of threads" << std::endl;
+    return good ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "CollisionLibrary.hpp"
+#include "TrackGenerator.hpp"
+
+// Time per track of the generator variants (TrackGeneratorA/B/C) on one thread,
+// reading the library from the DB file and from memory (CollisionLibrary).
+
+template <typename Generator>
+void Run(const std::string &_name, Generator &_gen, int _nTracks, double _ekin)
+{
+    _gen.SetSeed(1);
+    _gen.SetTrackIndex(0);
+    std::size_t nCollisions = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < _nTracks; ++i)
+        nCollisions += _gen.Generate(_ekin, 0, 0, 0, 1, 0, 0).size();
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "   " << _name << " : " << sec * 1e6 / _nTracks << " us/track, "
+              << sec * 1e9 / nCollisions << " ns/collision ("
+              << double(nCollisions) / _nTracks << " collisions/track)" << std::endl;
+}
+
+void RunVariants(const std::string &_source, int _nTracks, double _ekin,
+                 TrackGeneratorA &_a, TrackGeneratorB &_b, TrackGeneratorC &_c)
+{
+    std::cout << _source << std::endl;
+    Run("A", _a, _nTracks, _ekin);
+    Run("B", _b, _nTracks, _ekin);
+    // Transfer() prints every jump, which would dominate the time
+    _c.SetTransferProbability(0);
+    Run("C (p = 0)", _c, _nTracks, _ekin);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << argv[0] << " [library] [energy_eV] ([tracks])" << std::endl;
+        return 1;
+    }
+    const std::string library = argv[1];
+    const double ekin = std::atof(argv[2]);
+    const int nTracks = argc > 3 ? std::atoi(argv[3]) : 300;
+
+    {
+        TrackGeneratorA a(library);
+        TrackGeneratorB b(library);
+        TrackGeneratorC c(library);
+        if (!a.IsAccesible())
+        {
+            std::cerr << "Cannot read " << library << std::endl;
+            return 1;
+        }
+        RunVariants("DB file (SQLite)", nTracks, ekin, a, b, c);
+    }
+
+    {
+        auto memory = CollisionLibrary::Open(library);
+        TrackGeneratorA a;
+        TrackGeneratorB b;
+        TrackGeneratorC c;
+        a.SetLibrary(memory);
+        b.SetLibrary(memory);
+        c.SetLibrary(memory);
+        RunVariants("Library in memory (CollisionLibrary)", nTracks, ekin, a, b, c);
+    }
+    return 0;
+}
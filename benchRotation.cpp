@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "CounterRandom.hpp"
+#include "TRIM2SQLite.hpp"
+#include "VectorAndMatrix.hpp"
+
+// Old (trigonometric) rotation kernels against the current ones of VectorAndMatrix.hpp:
+// both must give the same matrices within kTolerance, and the time of each is printed.
+// The Philox4x32-10 generator of the random streams is checked first against the
+// known-answer vectors of Random123 (kat_vectors, philox4x32_10).
+
+using Vector = TRIM2SQLite::CollisionRecord::xyz;
+using Matrix = Mm::Matrix<Vector>;
+
+// Largest allowed |old - new| of a matrix element or a direction component
+static const double kTolerance = 1e-12;
+
+namespace Old
+{
+    // MakeRotaionMatrix(axis, angle) before the trig-free kernels
+    Matrix MakeRotaionMatrix(const Vector &_axis, double _degree)
+    {
+        double norm = Mm::Norm(_axis);
+        Matrix mat;
+        double nx = _axis.X() / norm;
+        double ny = _axis.Y() / norm;
+        double nz = _axis.Z() / norm;
+        double sn = sin(_degree);
+        double cs = cos(_degree);
+
+        mat.fXX = nx * nx * (1 - cs) + cs;
+        mat.fXY = nx * ny * (1 - cs) - nz * sn;
+        mat.fXZ = nz * nx * (1 - cs) + ny * sn;
+
+        mat.fYX = nx * ny * (1 - cs) + nz * sn;
+        mat.fYY = ny * ny * (1 - cs) + cs;
+        mat.fYZ = ny * nz * (1 - cs) - nx * sn;
+
+        mat.fZX = nz * nx * (1 - cs) - ny * sn;
+        mat.fZY = ny * nz * (1 - cs) + nx * sn;
+        mat.fZZ = nz * nz * (1 - cs) + cs;
+
+        return mat;
+    }
+
+    // MakeRotaionMatrix(dir1, dir2) : axis and angle by acos
+    Matrix MakeRotaionMatrix(const Vector &_dir1, const Vector &_dir2)
+    {
+        Vector dir1 = _dir1;
+        Mm::Normalize(dir1);
+        Vector dir2 = _dir2;
+        Mm::Normalize(dir2);
+        auto axis = Mm::CrossProduct(dir1, dir2);
+        Mm::Normalize(axis);
+        return MakeRotaionMatrix(axis, Mm::Angle(dir1, dir2));
+    }
+
+    // Body of PhiRotationRandom : rotate the scattering direction _dx1 and _mat about _dx0
+    void PhiRotation(const Vector &_dx0, double _angle, Vector &_dx1, Matrix &_mat)
+    {
+        auto rotation = MakeRotaionMatrix(_dx0, _angle);
+        _dx1 = rotation.Apply(_dx1);
+        Mm::Normalize(_dx1);
+        _mat = rotation * _mat;
+        _mat.Normalize();
+    }
+}
+
+namespace New
+{
+    // Body of TrackPolicy::RandomPhiRotation::RotateFirst
+    void PhiRotation(const Vector &_dx0, double _cs, double _sn, Vector &_dx1, Matrix &_mat)
+    {
+        _dx1 = Mm::RotateUnitAxis(_dx0, _cs, _sn, _dx1);
+        Mm::Normalize(_dx1);
+        _mat = Mm::MakeRotaionMatrixUnitAxis(_dx0, _cs, _sn) * _mat;
+        _mat.Orthonormalize();
+    }
+}
+
+// Counter, key and expected output of Philox4x32-10 (Random123 kat_vectors)
+static bool CheckPhilox()
+{
+    struct KnownAnswer
+    {
+        std::uint32_t fCtr[4], fKey[2], fOut[4];
+    };
+    static const KnownAnswer answers[] = {
+        {{0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u}, {0x00000000u, 0x00000000u},
+         {0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u}},
+        {{0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu}, {0xffffffffu, 0xffffffffu},
+         {0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu}},
+        {{0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u}, {0xa4093822u, 0x299f31d0u},
+         {0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u}}};
+
+    bool good = true;
+    for (const auto &answer : answers)
+    {
+        Mm::Philox4x32::Block ctr;
+        std::copy(answer.fCtr, answer.fCtr + 4, ctr.fV);
+        const auto out = Mm::Philox4x32::Apply(ctr, answer.fKey[0], answer.fKey[1]);
+        if (!std::equal(answer.fOut, answer.fOut + 4, out.fV))
+            good = false;
+    }
+    std::cout << "Philox4x32-10 known answers : " << (good ? "OK" : "FAILED") << std::endl;
+    return good;
+}
+
+static Vector RandomDirection(Mm::CounterRandom &_random)
+{
+    double cs = 2 * _random() - 1;
+    double sn = std::sqrt(1 - cs * cs);
+    double phi = 2 * M_PI * _random();
+    return Vector(sn * std::cos(phi), sn * std::sin(phi), cs);
+}
+
+static double MaxDifference(const Matrix &_l, const Matrix &_r)
+{
+    double ret = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        auto d = Mm::Add(_l.Row(i), Mm::Scale(-1.0, _r.Row(i)));
+        ret = std::max(ret, std::max(std::abs(d.X()), std::max(std::abs(d.Y()), std::abs(d.Z()))));
+    }
+    return ret;
+}
+
+static double MaxDifference(const Vector &_l, const Vector &_r)
+{
+    return std::max(std::abs(_l.X() - _r.X()), std::max(std::abs(_l.Y() - _r.Y()), std::abs(_l.Z() - _r.Z())));
+}
+
+static double Seconds(std::chrono::steady_clock::time_point _start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    // Number of direction pairs and of phi-rotations per chain
+    const int nPairs = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    const int nSteps = argc > 2 ? std::atoi(argv[2]) : 1000;
+    const int nChains = nPairs / nSteps > 0 ? nPairs / nSteps : 1;
+
+    Mm::CounterRandom random(1, 0);
+    bool good = CheckPhilox();
+
+    // MakeRotaionMatrix(dir1, dir2)
+    {
+        std::vector<Vector> dir1(nPairs), dir2(nPairs);
+        for (int i = 0; i < nPairs; ++i)
+        {
+            dir1[i] = RandomDirection(random);
+            dir2[i] = RandomDirection(random);
+        }
+
+        double diff = 0;
+        double maxAngleError = 0;
+        for (int i = 0; i < nPairs; ++i)
+        {
+            auto mat = Mm::MakeRotaionMatrix(dir1[i], dir2[i]);
+            diff = std::max(diff, MaxDifference(Old::MakeRotaionMatrix(dir1[i], dir2[i]), mat));
+            maxAngleError = std::max(maxAngleError, MaxDifference(mat.Apply(dir1[i]), dir2[i]));
+        }
+
+        double sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nPairs; ++i)
+            sum += Old::MakeRotaionMatrix(dir1[i], dir2[i]).fXY;
+        const double tOld = Seconds(start);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nPairs; ++i)
+            sum += Mm::MakeRotaionMatrix(dir1[i], dir2[i]).fXY;
+        const double tNew = Seconds(start);
+
+        std::cout << "MakeRotaionMatrix(dir1, dir2) : " << nPairs << " pairs" << std::endl;
+        std::cout << "   old " << tOld * 1e9 / nPairs << " ns, new " << tNew * 1e9 / nPairs
+                  << " ns, speed-up " << tOld / tNew << " (checksum " << sum << ")" << std::endl;
+        std::cout << "   max |old - new| = " << diff << ", max |R dir1 - dir2| = " << maxAngleError << std::endl;
+        if (!(diff < kTolerance))
+            good = false;
+    }
+
+    // Phi-rotation chains : the transform of a track of nSteps collisions
+    {
+        std::vector<Vector> dx0(nSteps);
+        std::vector<double> cs(nSteps), sn(nSteps), angle(nSteps);
+
+        double diffMat = 0;
+        double diffDir = 0;
+        double tOld = 0;
+        double tNew = 0;
+        double sum = 0;
+        for (int chain = 0; chain < nChains; ++chain)
+        {
+            for (int i = 0; i < nSteps; ++i)
+            {
+                dx0[i] = RandomDirection(random);
+                auto uniform = [&random]() { return random(); };
+                Mm::RandomUnitCircle(uniform, cs[i], sn[i]);
+                // Same rotation angle for the old path
+                angle[i] = std::atan2(sn[i], cs[i]);
+            }
+            const Vector dx1 = RandomDirection(random);
+
+            Matrix matOld, matNew;
+            Vector dx1Old = dx1, dx1New = dx1;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < nSteps; ++i)
+                Old::PhiRotation(dx0[i], angle[i], dx1Old, matOld);
+            tOld += Seconds(start);
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < nSteps; ++i)
+                New::PhiRotation(dx0[i], cs[i], sn[i], dx1New, matNew);
+            tNew += Seconds(start);
+
+            sum += matOld.fXY + matNew.fXY;
+            diffMat = std::max(diffMat, MaxDifference(matOld, matNew));
+            diffDir = std::max(diffDir, MaxDifference(dx1Old, dx1New));
+        }
+
+        const double n = double(nChains) * nSteps;
+        std::cout << "Phi-rotation : " << nChains << " chains of " << nSteps << " rotations" << std::endl;
+        std::cout << "   old " << tOld * 1e9 / n << " ns, new " << tNew * 1e9 / n
+                  << " ns, speed-up " << tOld / tNew << " (checksum " << sum << ")" << std::endl;
+        std::cout << "   max |old - new| = " << diffMat << " (matrix), " << diffDir << " (direction)" << std::endl;
+        if (!(diffMat < kTolerance && diffDir < kTolerance))
+            good = false;
+    }
+
+    std::cout << (good ? "OK" : "FAILED") << " : tolerance " << kTolerance << std::endl;
+    return good ? 0 : 1;
+}
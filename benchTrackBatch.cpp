@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CounterRandom.hpp"
+#include "TrackBatch.hpp"
+
+// Time of the TrackBatch kernels (scalar, AVX2, AVX-512) on one long track,
+// and check that the SIMD kernels give the same bits as the scalar one.
+
+template <typename Real>
+BasicTrackBatch<Real> MakeTrack(std::size_t _n)
+{
+    using Vector = typename BasicTrackBatch<Real>::Vector;
+    Mm::CounterRandom random(2, 0);
+    auto direction = [&random]() {
+        double cs = 2 * random() - 1;
+        double sn = std::sqrt(1 - cs * cs);
+        double phi = 2 * M_PI * random();
+        return Vector(sn * std::cos(phi), sn * std::sin(phi), cs);
+    };
+
+    BasicTrackBatch<Real> batch;
+    batch.Resize(_n);
+    for (std::size_t i = 0; i < _n; ++i)
+    {
+        batch.SetStep(i, direction(), 1e-4 * random());
+        batch.SetTransform(i, Mm::MakeRotaionMatrix(direction(), direction()));
+    }
+    return batch;
+}
+
+template <typename Real>
+bool Run(const char *_type, std::size_t _n, int _repeat)
+{
+    const auto track = MakeTrack<Real>(_n);
+    const typename BasicTrackBatch<Real>::Vector start(0, 0, 0);
+
+    bool good = true;
+    double tScalar = 0;
+    BasicTrackBatch<Real> reference;
+    for (const char *kernel : {"scalar", "avx2", "avx512f"})
+    {
+        if (!BasicTrackBatch<Real>::SetKernel(kernel))
+        {
+            std::cout << _type << " " << kernel << " : not supported" << std::endl;
+            continue;
+        }
+
+        BasicTrackBatch<Real> batch;
+        double t = 0;
+        for (int i = 0; i < _repeat; ++i)
+        {
+            batch = track;
+            auto begin = std::chrono::steady_clock::now();
+            batch.Apply(start);
+            t += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        }
+        t *= 1e9 / (double(_n) * _repeat);
+
+        bool same = true;
+        if (reference.Size() == 0)
+        {
+            reference = batch;
+            tScalar = t;
+        }
+        for (std::size_t i = 0; i < _n && same; ++i)
+        {
+            auto d0 = reference.GetDirection(i), d1 = batch.GetDirection(i);
+            auto p0 = reference.GetPosition(i), p1 = batch.GetPosition(i);
+            same = d0.X() == d1.X() && d0.Y() == d1.Y() && d0.Z() == d1.Z() &&
+                   p0.X() == p1.X() && p0.Y() == p1.Y() && p0.Z() == p1.Z();
+        }
+        good = good && same;
+
+        std::cout << _type << " " << kernel << " : " << t << " ns/collision, speed-up "
+                  << tScalar / t << (same ? "" : " (DIFFERENT from scalar)") << std::endl;
+    }
+    BasicTrackBatch<Real>::SetKernel("");
+    return good;
+}
+
+int main(int argc, char *argv[])
+{
+    const std::size_t n = argc > 1 ? std::atol(argv[1]) : 100000;
+    const int repeat = argc > 2 ? std::atoi(argv[2]) : 50;
+
+    bool good = Run<double>("double", n, repeat);
+    good = Run<float>("float", n, repeat) && good;
+    std::cout << (good ? "OK" : "FAILED") << " : SIMD kernels bit-identical to scalar" << std::endl;
+    return good ? 0 : 1;
+}
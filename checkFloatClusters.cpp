@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ClusterPlacement.hpp"
+#include "CollisionLibrary.hpp"
+#include "GenerateMany.hpp"
+
+// Accuracy of single-precision generation (TrackGeneratorBFloat) against double
+// (TrackGeneratorB) on the cluster distributions: the same tracks (same seed) are turned
+// into clusters as TrackTrimSQLite does (one per recoil, evenly spaced along each step,
+// one electron per work function, no medium or drift area), then the clusters, their
+// longitudinal and lateral distributions and the moments of both are compared.
+
+namespace
+{
+    struct Clusters
+    {
+        std::vector<double> x, y, z;
+        std::vector<int> electrons;
+        // First cluster of each track
+        std::vector<std::size_t> first;
+    };
+
+    template <typename Track>
+    void MakeClusters(const std::vector<Track> &_tracks, double _work, Clusters &_clusters)
+    {
+        ClusterPlacement placement;
+        for (const auto &track : _tracks)
+        {
+            _clusters.first.push_back(_clusters.x.size());
+            for (const auto &col : track)
+            {
+                const auto pos = col.GetPosition();
+                const int nRecoil = std::round(col.GetRecoilEnergy() / _work);
+                if (col.GetRecoilEnergy() > 0 && nRecoil > 0)
+                {
+                    _clusters.x.push_back(pos.X());
+                    _clusters.y.push_back(pos.Y());
+                    _clusters.z.push_back(pos.Z());
+                    _clusters.electrons.push_back(nRecoil);
+                }
+
+                const int nElectrons = std::round(col.GetEnergyLoss() / _work);
+                if (nElectrons <= 0)
+                    continue;
+                const double dr = col.GetDistanceToNextCollision();
+                const auto dir = col.GetScatteringDirection();
+                placement.Even(nElectrons);
+                placement.Place(pos.X(), pos.Y(), pos.Z(), dr * dir.X(), dr * dir.Y(), dr * dir.Z());
+                for (std::size_t i = 0; i < placement.Size(); ++i)
+                {
+                    _clusters.x.push_back(placement.GetX()[i]);
+                    _clusters.y.push_back(placement.GetY()[i]);
+                    _clusters.z.push_back(placement.GetZ()[i]);
+                    _clusters.electrons.push_back(1);
+                }
+            }
+        }
+        _clusters.first.push_back(_clusters.x.size());
+    }
+
+    // Electron-weighted histogram, mean and RMS of one quantity
+    struct Distribution
+    {
+        std::vector<double> fBins;
+        double fMin, fMax;
+        double fSum = 0, fSum2 = 0, fWeight = 0;
+
+        Distribution(std::size_t _nBins, double _fMin, double _fMax)
+            : fBins(_nBins), fMin(_fMin), fMax(_fMax){};
+
+        void Fill(double _value, double _weight)
+        {
+            const double f = (_value - fMin) / (fMax - fMin) * fBins.size();
+            if (f >= 0 && f < fBins.size())
+                fBins[std::size_t(f)] += _weight;
+            fSum += _weight * _value;
+            fSum2 += _weight * _value * _value;
+            fWeight += _weight;
+        }
+        double Mean() const { return fSum / fWeight; };
+        double RMS() const { return std::sqrt(std::max(0., fSum2 / fWeight - Mean() * Mean())); };
+    };
+
+    // Longitudinal (along x, the initial direction) and lateral distributions
+    void Fill(const Clusters &_clusters, Distribution &_longitudinal, Distribution &_lateral)
+    {
+        for (std::size_t i = 0; i < _clusters.x.size(); ++i)
+        {
+            _longitudinal.Fill(_clusters.x[i], _clusters.electrons[i]);
+            _lateral.Fill(std::sqrt(_clusters.y[i] * _clusters.y[i] + _clusters.z[i] * _clusters.z[i]),
+                          _clusters.electrons[i]);
+        }
+    }
+
+    // Fraction of the weight which moved to another bin
+    double Migration(const Distribution &_d, const Distribution &_f)
+    {
+        double diff = 0;
+        for (std::size_t i = 0; i < _d.fBins.size(); ++i)
+            diff += std::abs(_d.fBins[i] - _f.fBins[i]);
+        return diff / 2 / _d.fWeight;
+    }
+
+    double Relative(double _d, double _f) { return std::abs(_f - _d) / std::abs(_d); }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << argv[0] << " [library] [energy_eV] ([tracks]) ([work_function_eV])" << std::endl;
+        return 1;
+    }
+    const double ekin = std::atof(argv[2]);
+    const std::size_t nTracks = argc > 3 ? std::atol(argv[3]) : 200;
+    const double work = argc > 4 ? std::atof(argv[4]) : 30;
+
+    // Tolerances of the check
+    const double maxPositionError = 1e-5;  // of the track extent, per cluster
+    const double maxMomentError = 1e-5;    // relative, means and RMS
+    const double maxMigration = 1e-3;      // fraction of electrons changing bin
+
+    auto library = CollisionLibrary::Open(argv[1]);
+    TrackGeneratorB genDouble;
+    TrackGeneratorBFloat genFloat;
+    genDouble.SetLibrary(library);
+    genFloat.SetLibrary(library);
+    genDouble.SetSeed(1);
+    genFloat.SetSeed(1);
+
+    Clusters cDouble, cFloat;
+    MakeClusters(GenerateMany(genDouble, nTracks, ekin, 0, 0, 0, 1, 0, 0), work, cDouble);
+    MakeClusters(GenerateMany(genFloat, nTracks, ekin, 0, 0, 0, 1, 0, 0), work, cFloat);
+
+    // Ranges of the histograms from the double clusters
+    double xMin = 0, xMax = 0, rMax = 0;
+    for (std::size_t i = 0; i < cDouble.x.size(); ++i)
+    {
+        xMin = std::min(xMin, cDouble.x[i]);
+        xMax = std::max(xMax, cDouble.x[i]);
+        rMax = std::max(rMax, std::sqrt(cDouble.y[i] * cDouble.y[i] + cDouble.z[i] * cDouble.z[i]));
+    }
+    const double extent = std::max(xMax - xMin, rMax);
+
+    // Cluster by cluster, for the tracks with the same number of clusters
+    double maxDiff = 0, sumDiff = 0;
+    std::size_t nCompared = 0, nDifferentTracks = 0;
+    for (std::size_t t = 0; t < nTracks; ++t)
+    {
+        const std::size_t n = cDouble.first[t + 1] - cDouble.first[t];
+        if (n != cFloat.first[t + 1] - cFloat.first[t])
+        {
+            ++nDifferentTracks;
+            continue;
+        }
+        for (std::size_t i = cDouble.first[t], j = cFloat.first[t]; i < cDouble.first[t + 1]; ++i, ++j)
+        {
+            const double d = std::max(std::abs(cDouble.x[i] - cFloat.x[j]),
+                                      std::max(std::abs(cDouble.y[i] - cFloat.y[j]), std::abs(cDouble.z[i] - cFloat.z[j])));
+            maxDiff = std::max(maxDiff, d);
+            sumDiff += d;
+            ++nCompared;
+        }
+    }
+
+    const std::size_t nBins = 100;
+    Distribution lDouble(nBins, xMin, xMax), rDouble(nBins, 0, rMax);
+    Distribution lFloat(nBins, xMin, xMax), rFloat(nBins, 0, rMax);
+    Fill(cDouble, lDouble, rDouble);
+    Fill(cFloat, lFloat, rFloat);
+
+    std::cout << nTracks << " tracks at " << ekin << " eV, " << cDouble.x.size() << " clusters (double), "
+              << cFloat.x.size() << " (float), extent " << extent << std::endl;
+    std::cout << "Cluster positions : max |float - double| " << maxDiff << " (" << maxDiff / extent
+              << " of the extent), mean " << sumDiff / nCompared << ", "
+              << nDifferentTracks << " tracks with a different number of clusters" << std::endl;
+    std::cout << "Longitudinal : mean " << lDouble.Mean() << " / " << lFloat.Mean()
+              << ", RMS " << lDouble.RMS() << " / " << lFloat.RMS()
+              << ", bin migration " << Migration(lDouble, lFloat) << std::endl;
+    std::cout << "Lateral      : mean " << rDouble.Mean() << " / " << rFloat.Mean()
+              << ", RMS " << rDouble.RMS() << " / " << rFloat.RMS()
+              << ", bin migration " << Migration(rDouble, rFloat) << std::endl;
+
+    const double momentError = std::max(std::max(Relative(lDouble.Mean(), lFloat.Mean()), Relative(lDouble.RMS(), lFloat.RMS())),
+                                        std::max(Relative(rDouble.Mean(), rFloat.Mean()), Relative(rDouble.RMS(), rFloat.RMS())));
+    const bool good = nDifferentTracks == 0 && maxDiff <= maxPositionError * extent &&
+                      momentError <= maxMomentError &&
+                      Migration(lDouble, lFloat) <= maxMigration && Migration(rDouble, rFloat) <= maxMigration;
+    std::cout << (good ? "OK" : "FAILED") << " : tolerances " << maxPositionError << " of the extent per cluster, "
+              << maxMomentError << " on the moments, " << maxMigration << " bin migration" << std::endl;
+    return good ? 0 : 1;
+}
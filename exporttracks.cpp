@@ -0,0 +1,44 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "ExportTracks.hpp"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << argv[0] << " [input_library] [output_root_file] ([threads]) ([--compact])" << std::endl;
+        std::cerr << "   Every track of the library becomes one entry of the tree \"tr\"," << std::endl;
+        std::cerr << "   in the layout of TrackTreeFile (single precision with --compact)." << std::endl;
+        std::cerr << "   threads : 0 (default) for all cores" << std::endl;
+        return 1;
+    }
+
+    int nThreads = 0;
+    auto schema = TrackTreeFile::Schema::Full;
+    for (int i = 3; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--compact")
+            schema = TrackTreeFile::Schema::Compact;
+        else
+            nThreads = std::atoi(argv[i]);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::size_t n = 0;
+    try
+    {
+        n = ExportTracks(argv[1], argv[2], schema, nThreads);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to export " << argv[1] << " : " << e.what() << std::endl;
+        return 1;
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << n << " tracks written to " << argv[2] << " in " << sec << " s" << std::endl;
+    return 0;
+}
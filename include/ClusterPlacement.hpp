@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "CounterRandom.hpp"
+#include "Span.hpp"
+
+// Positions of the clusters along one step (x0 + t d, 0 < t < 1).
+// Sorted uniform positions are made in O(n) from normalized exponential spacings
+//     t_k = (E_1 + ... + E_k) / (E_1 + ... + E_{n+1}),  E_i = -log(1 - U_i),
+// which have the distribution of n sorted uniforms without sorting.
+// A few positions are sorted directly, which is cheaper than the logarithms.
+// Scratch arrays are kept between steps.
+class ClusterPlacement
+{
+public:
+    ClusterPlacement(){};
+
+    // _n sorted random positions
+    void SortedRandom(Mm::CounterRandom &_random, std::size_t _n);
+    // _n evenly spaced positions k / (_n + 1)
+    void Even(std::size_t _n);
+
+    // Coordinates of the positions on the step from (_x, _y, _z) by (_dx, _dy, _dz)
+    void Place(double _x, double _y, double _z,
+               double _dx, double _dy, double _dz);
+
+    std::size_t Size() const { return fT.size(); };
+    Span<const double> GetPositions() const { return fT; };
+    // Valid after Place()
+    Span<const double> GetX() const { return fX; };
+    Span<const double> GetY() const { return fY; };
+    Span<const double> GetZ() const { return fZ; };
+
+private:
+    // Largest number of positions sorted by insertion
+    static constexpr std::size_t SortThreshold = 16;
+
+    std::vector<double> fT;
+    std::vector<double> fX, fY, fZ;
+};
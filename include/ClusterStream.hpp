@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free queue of clusters from one producer (TrackTrimSQLite::NewTrack)
+// to any number of consumer threads (drift or avalanche workers,
+// each with its own Garfield transport object).
+// Clusters are published while the track is being generated,
+// so transport can start before the track is finished.
+//
+// Each slot carries a sequence number (bounded queue of D. Vyukov):
+// the producer fills slot pos when its sequence is pos and releases it with pos + 1,
+// a consumer claims it by advancing the head with a CAS and frees it with pos + capacity.
+// The producer waits (yields) while the queue is full, so consumers must be running.
+class ClusterStream
+{
+public:
+    struct Cluster
+    {
+        double fX, fY, fZ, fT; // Cluster location and time
+        double fEnergy;        // Energy spent to make the cluster
+        double fKinetic;       // Ion energy when the cluster was created
+        int fElectrons;        // Number of electrons in the cluster
+        std::uint32_t fIndex;  // Cluster number in its track
+        std::uint64_t fTrack;  // Track index of the generator
+    };
+
+    // _capacity is rounded up to a power of two (at least 2)
+    explicit ClusterStream(std::size_t _capacity = 4096);
+    ClusterStream(const ClusterStream &) = delete;
+    ClusterStream &operator=(const ClusterStream &) = delete;
+
+    std::size_t GetCapacity() const { return fMask + 1; };
+
+    // Producer side (one thread)
+    bool TryPush(const Cluster &_cluster);
+    // Waits while the queue is full
+    void Push(const Cluster &_cluster);
+    // No more clusters: Pop returns false once the queue is drained
+    void Close();
+    bool IsClosed() const { return fClosed.load(std::memory_order_acquire); };
+
+    // Consumer side (any number of threads)
+    bool TryPop(Cluster &_cluster);
+    // Waits for a cluster; false when the stream is closed and empty
+    bool Pop(Cluster &_cluster);
+
+    // Clusters pushed so far (producer thread)
+    std::uint64_t GetNumberOfPushed() const { return fTail; };
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> fSequence;
+        Cluster fCluster;
+    };
+
+    // Head and tail on separate cache lines, away from the slots
+    static constexpr std::size_t CacheLine = 64;
+
+    std::unique_ptr<Slot[]> fSlots;
+    std::size_t fMask;
+    char fPad0[CacheLine];
+    std::atomic<std::size_t> fHead; // next slot to consume
+    char fPad1[CacheLine];
+    std::size_t fTail;              // next slot to fill (producer only)
+    std::atomic<bool> fClosed;
+    char fPad2[CacheLine];
+};
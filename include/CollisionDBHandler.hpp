@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -7,6 +8,13 @@
 
 #include "TRIM2SQLite.hpp"
 
+// One catalog row : incident energy of a library track
+struct CatalogRecord
+{
+    int fTrackID;
+    double fEnergy; // eV
+};
+
 class CollisionDBHandler
 {
 public:
@@ -35,7 +43,25 @@ public:
     GetCollisions(const std::string &_constraint,
                   int _limit = -1);
 
+    // Incident energy of every track, ordered by energy and track ID.
+    // Libraries without catalog table fall back to the first collisions.
+    std::vector<CatalogRecord> GetCatalog();
+    bool HasCatalog();
+
+    // Every collision ordered by track ID and collision ID, one at a time
+    // (the whole library is not held in memory at once)
+    void ReadAllCollisions(const std::function<void(const TRIM2SQLite::CollisionRecord &)> &_callback);
+    // The same for the tracks with _trackIDMin <= track ID <= _trackIDMax (one range scan of the key)
+    void ReadCollisions(int _trackIDMin, int _trackIDMax,
+                        const std::function<void(const TRIM2SQLite::CollisionRecord &)> &_callback);
+
 private:
+    static void ReadRow(sqlite3_stmt *_query, TRIM2SQLite::CollisionRecord &_rec);
+    // Calls _callback for every row of the SELECT * FROM collisions query _query
+    // with the integer parameters _parameters (errors are reported as from _caller)
+    void ReadCollisions(const std::string &_caller, const std::string &_query,
+                        const std::vector<int> &_parameters,
+                        const std::function<void(const TRIM2SQLite::CollisionRecord &)> &_callback);
     int ExecuteCountQuery(const std::string &_query);
     int ExecuteSelectQuery(const std::string &_query,
                            std::vector<TRIM2SQLite::CollisionRecord> &_rec);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CollisionDBHandler.hpp"
+#include "Span.hpp"
+
+// Collision library of a DB file held in memory and never modified after loading.
+// Any number of generators, also on different threads, can share one instance
+// through std::shared_ptr and keep only their own random stream and scratch buffers.
+//
+// The data is one relocatable image (header and flat arrays addressed by offsets),
+// so that it can also be published in a POSIX shared-memory segment
+// and mapped read-only by the other processes on the node (OpenShared).
+class CollisionLibrary
+{
+public:
+    using CollisionRecord = TRIM2SQLite::CollisionRecord;
+
+    // Layout version of the image, to be incremented when the layout changes
+    static constexpr std::uint32_t ImageFormat = 1;
+
+    // Read all collisions and the energy catalog of _fileName (throws if it cannot be read)
+    static std::shared_ptr<const CollisionLibrary> Load(const std::string &_fileName);
+
+    // Library of _fileName shared within the process:
+    // loaded by the first call and reused as long as someone holds it
+    static std::shared_ptr<const CollisionLibrary> Open(const std::string &_fileName);
+
+    // Library of _fileName shared between the processes of the node.
+    // The first process loads the file and publishes the image in a shared-memory segment,
+    // the others (and later threads of the same process) map it read-only.
+    // A segment made from another format or an older version of the file (size, mtime)
+    // is replaced, one left incomplete by a crashed process as well.
+    static std::shared_ptr<const CollisionLibrary> OpenShared(const std::string &_fileName);
+
+    // Remove the segment of _fileName (false if there is none).
+    // Processes that mapped it keep their mapping. Segments stay in /dev/shm until removed.
+    static bool RemoveShared(const std::string &_fileName);
+
+    // Name of the shared-memory segment of _fileName
+    static std::string GetSharedName(const std::string &_fileName);
+
+    const std::string &GetFileName() const { return fFileName; };
+    bool IsShared() const { return fShared; };
+    // Bytes of the image (the whole library)
+    std::size_t GetImageSize() const { return fImageSize; };
+
+    std::size_t GetNumberOfTracks() const { return fTrackIDs.size(); };
+    std::size_t GetNumberOfCollisions() const { return fRows.size(); };
+
+    // Incident energies of the tracks (ascending)
+    Span<const double> GetEnergies() const { return fEnergies; };
+
+    // Track IDs (ascending) of the lowest library energy not below _ekin
+    Span<const int> GetTrackIDs(double _ekin) const;
+
+    // Collisions of a track, the same records as CollisionDBHandler::GetTrack()
+    std::vector<CollisionRecord> GetTrack(int _trackID) const;
+
+    // Transfer destinations (see RandomTransfer): collisions with
+    //   _ene_min <= e_inc - e_rec <= _ene_max,  0 < e_inc - e_rec - de < _ene,  0 < dr
+    // in track IDs [_trackIDMin, _trackIDMax] (no limit if negative), ordered by track and collision ID
+    std::vector<CollisionRecord> GetTransferCandidates(double _ene, double _ene_min, double _ene_max,
+                                                       int _trackIDMin = -1, int _trackIDMax = -1) const;
+
+private:
+    CollisionLibrary() : fFileName(), fShared(false), fImageSize(0), fStorage(),
+                         fRows(), fIons(), fTrackIDs(), fTrackBegin(),
+                         fEnergyOut(), fEnergyOutRow(), fEnergies(), fEnergyBegin(), fEnergyTrackIDs(){};
+
+    // Plain copy of one collision (ion names are indices of fIons)
+    struct Row
+    {
+        int fTrackID;
+        int fCollisionID;
+        int fMassNumber;
+        std::uint16_t fIncidentIon;
+        std::uint16_t fRecoilIon;
+        double fIncidentEnergy;
+        double fRecoilEnergy;
+        CollisionRecord::xyz fPosition;
+        CollisionRecord::xyz fIncidentDirection;
+        CollisionRecord::xyz fScatteringDirection;
+        double fDistanceToNextCollision;
+        double fEnergyLoss;
+    };
+
+    struct IonName
+    {
+        char fName[16]; // null-terminated
+    };
+
+    struct Header;
+    class Builder;
+
+    // Point the arrays into _image (checked by the caller)
+    void Attach(const char *_image);
+    CollisionRecord MakeRecord(const Row &_row) const;
+
+    static std::shared_ptr<const CollisionLibrary> Map(const std::string &_fileName, int _fd, bool &_stale);
+
+    std::string fFileName;
+    bool fShared;
+    std::size_t fImageSize;
+    // Owner of the image (heap buffer or shared-memory mapping)
+    std::shared_ptr<const char> fStorage;
+
+    // All collisions ordered by track and collision ID
+    Span<const Row> fRows;
+    Span<const IonName> fIons;
+
+    // Track fTrackIDs[i] (ascending) is fRows[fTrackBegin[i], fTrackBegin[i + 1])
+    Span<const int> fTrackIDs;
+    Span<const std::uint64_t> fTrackBegin;
+
+    // Energy after each collision (e_inc - e_rec, ascending) and its row
+    Span<const double> fEnergyOut;
+    Span<const std::uint64_t> fEnergyOutRow;
+
+    // Catalog : track IDs of energy fEnergies[i] are fEnergyTrackIDs[fEnergyBegin[i], fEnergyBegin[i + 1])
+    Span<const double> fEnergies;
+    Span<const std::uint64_t> fEnergyBegin;
+    Span<const int> fEnergyTrackIDs;
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "OutputSink.hpp"
+#include "Span.hpp"
+
+// Chunked columnar binary file, written without ROOT and readable with mmap (ColumnarReader).
+//
+// Layout (host byte order, every section starts at a multiple of 8 bytes):
+//   header  "MMCOLUMN", uint32 0x01020304 (byte order), uint32 version, uint32 number of columns,
+//           per column : uint8 type, uint8 level, uint16 name length, name
+//   chunk   "MMCHUNK", uint64 bytes of the chunk, uint64 entries, uint64 rows,
+//           uint64 bytes of each column, uint32 rows of each entry,
+//           the columns in the order of declaration
+// An entry column has one value per entry, a row column one value per row.
+//
+// Values are collected in memory and written one chunk at a time in large blocks.
+// A file opened for appending keeps its complete chunks (a chunk cut by a crash is dropped)
+// and gets the new ones after them.
+class ColumnarFile
+{
+public:
+    enum class Type : std::uint8_t
+    {
+        Float64 = 1,
+        Float32 = 2,
+        Int32 = 3,
+        UInt32 = 4,
+        UInt8 = 5
+    };
+    enum class Level : std::uint8_t
+    {
+        Entry = 1,
+        Row = 2
+    };
+    struct Column
+    {
+        std::string fName;
+        Type fType;
+        Level fLevel;
+
+        Column(const std::string &_fName, Type _fType, Level _fLevel)
+            : fName(_fName), fType(_fType), fLevel(_fLevel){};
+        bool operator==(const Column &_other) const
+        {
+            return fName == _other.fName && fType == _other.fType && fLevel == _other.fLevel;
+        };
+    };
+
+    // Type of the values of a C++ type
+    template <typename T>
+    struct TypeOf;
+    static std::size_t GetTypeSize(Type _type);
+
+    // _append : keep the chunks of an existing file with the same columns
+    ColumnarFile(const std::string &_fileName, const std::vector<Column> &_columns, bool _append = false);
+    // Writes the collected entries
+    ~ColumnarFile();
+    ColumnarFile(const ColumnarFile &) = delete;
+    ColumnarFile &operator=(const ColumnarFile &) = delete;
+
+    bool IsOpen() const { return fFile != nullptr; };
+    const std::string &GetFileName() const { return fFileName; };
+    const std::vector<Column> &GetColumns() const { return fColumns; };
+
+    // Bytes of values collected before a chunk is written (8 MB by default)
+    void SetChunkSize(std::size_t _fChunkSize) { fChunkSize = _fChunkSize; };
+    std::size_t GetChunkSize() const { return fChunkSize; };
+
+    // Values of the current entry
+    template <typename T>
+    void Put(std::size_t _column, T _value);
+    template <typename T>
+    void Put(std::size_t _column, Span<const T> _values);
+    // Close the current entry : every row column must have got _nRows values
+    // and every entry column one value. Otherwise the values of the entry are dropped
+    // (the chunk is left as after the last complete entry) and an exception is thrown.
+    void EndEntry(std::size_t _nRows);
+
+    // Entries closed so far (written or not)
+    std::uint64_t GetEntries() const { return fEntries + fRowCounts.size(); };
+
+    // Write the collected entries as one chunk
+    void Flush();
+    // Flush and close the file
+    void Close();
+
+private:
+    std::string fFileName;
+    std::FILE *fFile;
+    std::vector<Column> fColumns;
+    std::size_t fChunkSize;
+
+    // Chunk being collected
+    std::vector<std::vector<char>> fData;
+    std::vector<std::uint32_t> fRowCounts;
+    std::uint64_t fRows;
+
+    // Entries in the written chunks
+    std::uint64_t fEntries;
+
+    void CheckColumn(std::size_t _column, Type _type) const;
+    void WriteHeader();
+    void WriteBlock(const void *_data, std::size_t _size);
+};
+
+template <>
+struct ColumnarFile::TypeOf<double>
+{
+    static constexpr Type value = Type::Float64;
+};
+template <>
+struct ColumnarFile::TypeOf<float>
+{
+    static constexpr Type value = Type::Float32;
+};
+template <>
+struct ColumnarFile::TypeOf<std::int32_t>
+{
+    static constexpr Type value = Type::Int32;
+};
+template <>
+struct ColumnarFile::TypeOf<std::uint32_t>
+{
+    static constexpr Type value = Type::UInt32;
+};
+template <>
+struct ColumnarFile::TypeOf<std::uint8_t>
+{
+    static constexpr Type value = Type::UInt8;
+};
+
+template <typename T>
+void ColumnarFile::Put(std::size_t _column, T _value)
+{
+    CheckColumn(_column, TypeOf<T>::value);
+    const char *p = reinterpret_cast<const char *>(&_value);
+    fData[_column].insert(fData[_column].end(), p, p + sizeof(T));
+}
+
+template <typename T>
+void ColumnarFile::Put(std::size_t _column, Span<const T> _values)
+{
+    CheckColumn(_column, TypeOf<T>::value);
+    const char *p = reinterpret_cast<const char *>(_values.data());
+    fData[_column].insert(fData[_column].end(), p, p + _values.size() * sizeof(T));
+}
+
+// Read-only view of a ColumnarFile mapped in memory.
+// The columns of a chunk are arrays in the mapping (no copy);
+// a chunk cut at the end of the file is ignored, a complete chunk whose sizes
+// do not agree with its numbers of entries and rows is an error.
+class ColumnarReader
+{
+public:
+    explicit ColumnarReader(const std::string &_fileName);
+    ~ColumnarReader();
+    ColumnarReader(const ColumnarReader &) = delete;
+    ColumnarReader &operator=(const ColumnarReader &) = delete;
+
+    const std::vector<ColumnarFile::Column> &GetColumns() const { return fColumns; };
+    // Index of the column _name (throws if there is none)
+    std::size_t GetColumnIndex(const std::string &_name) const;
+
+    std::size_t GetNumberOfChunks() const { return fChunks.size(); };
+    std::uint64_t GetEntries() const;
+    std::uint64_t GetEntries(std::size_t _chunk) const { return fChunks.at(_chunk).fEntries; };
+    std::uint64_t GetRows(std::size_t _chunk) const { return fChunks.at(_chunk).fRows; };
+    // Rows of each entry of the chunk
+    Span<const std::uint32_t> GetRowCounts(std::size_t _chunk) const;
+
+    // Values of a column in a chunk (T must be the type of the column)
+    template <typename T>
+    Span<const T> GetColumn(std::size_t _chunk, std::size_t _column) const;
+    template <typename T>
+    Span<const T> GetColumn(std::size_t _chunk, const std::string &_name) const
+    {
+        return GetColumn<T>(_chunk, GetColumnIndex(_name));
+    };
+
+    // Bytes of the header and the complete chunks
+    std::uint64_t GetCompleteSize() const { return fCompleteSize; };
+
+private:
+    struct Chunk
+    {
+        std::uint64_t fEntries;
+        std::uint64_t fRows;
+        const std::uint32_t *fRowCounts;
+        std::vector<const char *> fColumns;
+        std::vector<std::uint64_t> fBytes;
+    };
+
+    void *fMap;
+    std::size_t fSize;
+    std::vector<ColumnarFile::Column> fColumns;
+    std::vector<Chunk> fChunks;
+    std::uint64_t fCompleteSize;
+};
+
+template <typename T>
+Span<const T> ColumnarReader::GetColumn(std::size_t _chunk, std::size_t _column) const
+{
+    const Chunk &chunk = fChunks.at(_chunk);
+    if (fColumns.at(_column).fType != ColumnarFile::TypeOf<T>::value)
+        throw std::runtime_error("ColumnarReader::GetColumn() :: Wrong type for " + fColumns[_column].fName);
+    return Span<const T>(reinterpret_cast<const T *>(chunk.fColumns[_column]),
+                         chunk.fBytes[_column] / sizeof(T));
+}
+
+// ROOT-free track sink: the branches of TrackTreeEntry as columns
+// (ion and atom as species codes, Species.hpp)
+class TrackColumnarFile : public TrackSink
+{
+public:
+    // Columns in the file
+    enum
+    {
+        Ion,
+        MassNumber,
+        Energy0,
+        TrackID,
+        CollisionID,
+        X,
+        Y,
+        Z,
+        DR,
+        Energy,
+        DX0,
+        DY0,
+        DZ0,
+        DX1,
+        DY1,
+        DZ1,
+        DEnergy,
+        Theta,
+        Recoil,
+        Atom
+    };
+    static const std::vector<ColumnarFile::Column> &GetColumns();
+
+    TrackColumnarFile(const std::string &_fileName, bool _append = false);
+
+    bool IsOpen() const override { return fFile.IsOpen(); };
+
+    using TrackSink::Fill;
+    void Fill(Span<const TRIM2SQLite::CollisionRecord> _track) override;
+
+    bool IsWritten() const override { return fWritten; };
+    // Write the remaining entries and close the file
+    void Write() override;
+
+    ColumnarFile &GetFile() { return fFile; };
+
+private:
+    ColumnarFile fFile;
+    bool fWritten;
+};
+
+// ROOT-free cluster sink: the branches of ClusterTreeEntry as columns
+class ClusterColumnarFile : public ClusterSink
+{
+public:
+    enum
+    {
+        X,
+        Y,
+        Z,
+        T,
+        Electrons,
+        EnergyCluster,
+        EnergyIon
+    };
+    static const std::vector<ColumnarFile::Column> &GetColumns();
+
+    ClusterColumnarFile(const std::string &_fileName, bool _append = false);
+
+    bool IsOpen() const override { return fFile.IsOpen(); };
+
+    void Fill(const ClusterColumns &_clusters) override;
+
+    bool IsWritten() const override { return fWritten; };
+    // Write the remaining entries and close the file
+    void Write() override;
+
+    ColumnarFile &GetFile() { return fFile; };
+
+private:
+    ColumnarFile fFile;
+    bool fWritten;
+};
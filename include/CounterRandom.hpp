@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Mm
+{
+    // Philox4x32-10 counter-based generator
+    // J. K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC'11
+    struct Philox4x32
+    {
+        struct Block
+        {
+            std::uint32_t fV[4];
+        };
+
+        static Block Apply(Block _ctr, std::uint32_t _key0, std::uint32_t _key1)
+        {
+            for (int iRound = 0; iRound < 10; ++iRound)
+            {
+                std::uint64_t p0 = std::uint64_t(0xD2511F53u) * _ctr.fV[0];
+                std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * _ctr.fV[2];
+
+                Block next;
+                next.fV[0] = std::uint32_t(p1 >> 32) ^ _ctr.fV[1] ^ _key0;
+                next.fV[1] = std::uint32_t(p1);
+                next.fV[2] = std::uint32_t(p0 >> 32) ^ _ctr.fV[3] ^ _key1;
+                next.fV[3] = std::uint32_t(p0);
+                _ctr = next;
+
+                _key0 += 0x9E3779B9u;
+                _key1 += 0xBB67AE85u;
+            }
+            return _ctr;
+        }
+    };
+
+    // Uniform random stream keyed by (seed, stream, substream).
+    // The n-th number of a stream depends only on the key and n,
+    // so any stream can be replayed on any thread or process.
+    class CounterRandom
+    {
+    public:
+        CounterRandom()
+            : fSeed(0), fStream(0), fSubstream(0), fCounter(0), fNext(4){};
+
+        CounterRandom(std::uint64_t _fSeed, std::uint64_t _fStream,
+                      std::uint32_t _fSubstream = 0)
+            : fSeed(_fSeed), fStream(_fStream), fSubstream(_fSubstream),
+              fCounter(0), fNext(4){};
+
+        void Reset(std::uint64_t _fSeed, std::uint64_t _fStream,
+                   std::uint32_t _fSubstream = 0)
+        {
+            fSeed = _fSeed;
+            fStream = _fStream;
+            fSubstream = _fSubstream;
+            fCounter = 0;
+            fNext = 4;
+        }
+
+        std::uint64_t GetSeed() const { return fSeed; };
+        std::uint64_t GetStream() const { return fStream; };
+        std::uint32_t GetSubstream() const { return fSubstream; };
+
+        std::uint32_t Next32()
+        {
+            if (fNext == 4)
+            {
+                Philox4x32::Block ctr;
+                ctr.fV[0] = fCounter;
+                ctr.fV[1] = fSubstream;
+                ctr.fV[2] = std::uint32_t(fStream);
+                ctr.fV[3] = std::uint32_t(fStream >> 32);
+                fBlock = Philox4x32::Apply(ctr,
+                                           std::uint32_t(fSeed),
+                                           std::uint32_t(fSeed >> 32));
+                ++fCounter;
+                fNext = 0;
+            }
+            return fBlock.fV[fNext++];
+        }
+
+        // Uniform in [0, 1) with 53-bit resolution
+        double Uniform()
+        {
+            std::uint32_t hi = Next32();
+            std::uint32_t lo = Next32();
+            return ToUniform(hi, lo);
+        }
+
+        double operator()() { return Uniform(); };
+
+        // _n uniforms in [0, 1), the same numbers as _n calls of Uniform()
+        void Uniform(double *_out, std::size_t _n)
+        {
+            std::size_t i = 0;
+            // Finish the current block first, then convert whole blocks (two numbers each)
+            while (i < _n && fNext != 4)
+                _out[i++] = Uniform();
+            for (; i + 2 <= _n; i += 2)
+            {
+                Philox4x32::Block ctr;
+                ctr.fV[0] = fCounter++;
+                ctr.fV[1] = fSubstream;
+                ctr.fV[2] = std::uint32_t(fStream);
+                ctr.fV[3] = std::uint32_t(fStream >> 32);
+                Philox4x32::Block out = Philox4x32::Apply(ctr,
+                                                          std::uint32_t(fSeed),
+                                                          std::uint32_t(fSeed >> 32));
+                _out[i] = ToUniform(out.fV[0], out.fV[1]);
+                _out[i + 1] = ToUniform(out.fV[2], out.fV[3]);
+            }
+            if (i < _n)
+                _out[i] = Uniform();
+        }
+
+    private:
+        static double ToUniform(std::uint64_t _hi, std::uint32_t _lo)
+        {
+            return ((_hi << 32 | _lo) >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        std::uint64_t fSeed;
+        std::uint64_t fStream;
+        std::uint32_t fSubstream;
+        std::uint32_t fCounter;
+        Philox4x32::Block fBlock;
+        int fNext;
+    };
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "GenerateMany.hpp"
+#include "WorkStealingPool.hpp"
+
+// Deposited energy on a regular 3D grid [xmin, xmax) x [ymin, ymax) x [zmin, zmax).
+// Recoil energies are deposited at the collision, the energy loss of a step
+// along the step (split into pieces of at most half a bin per axis).
+// Electron density is the energy divided by the W value.
+//
+// Bins hold fixed-point sums (1/65536 eV), so adding maps is exact and
+// the result does not depend on the order of the deposits or the number of threads.
+class DoseMap
+{
+public:
+    DoseMap(double _xmin, double _ymin, double _zmin,
+            double _xmax, double _ymax, double _zmax,
+            std::size_t _nx, std::size_t _ny, std::size_t _nz);
+
+    void SetWorkFunction(double _fWork) { fWork = _fWork; };
+    double GetWorkFunction() const { return fWork; };
+
+    std::size_t GetNx() const { return fN[0]; };
+    std::size_t GetNy() const { return fN[1]; };
+    std::size_t GetNz() const { return fN[2]; };
+    std::size_t GetNumberOfBins() const { return fEnergy.size(); };
+    // Bin size along axis 0 (x), 1 (y), 2 (z)
+    double GetBinWidth(int _axis) const { return fWidth[_axis]; };
+    // Center of bin _i along _axis
+    double GetBinCenter(int _axis, std::size_t _i) const { return fMin[_axis] + (_i + 0.5) * fWidth[_axis]; };
+
+    // Energy [eV] and number of electrons in bin (_ix, _iy, _iz)
+    double GetEnergy(std::size_t _ix, std::size_t _iy, std::size_t _iz) const
+    {
+        return ToEnergy(fEnergy[(_iz * fN[1] + _iy) * fN[0] + _ix]);
+    };
+    double GetElectrons(std::size_t _ix, std::size_t _iy, std::size_t _iz) const
+    {
+        return fWork > 0 ? GetEnergy(_ix, _iy, _iz) / fWork : 0;
+    };
+    // All bins, x fastest
+    std::vector<double> GetEnergies() const;
+
+    double GetTotalEnergy() const { return ToEnergy(fTotal); };
+    // Energy deposited outside the grid
+    double GetEnergyOutside() const { return ToEnergy(fOutside); };
+
+    // Deposit _e at a point
+    void Fill(double _x, double _y, double _z, double _e);
+    // Deposit _e uniformly along the segment (_x, _y, _z) + t (_dx, _dy, _dz), 0 <= t <= 1
+    void FillSegment(double _x, double _y, double _z,
+                     double _dx, double _dy, double _dz, double _e);
+
+    // Deposits of a collision: recoil at the collision, energy loss along the step
+    template <typename Collision>
+    void Fill(const Collision &_col);
+
+    // Add the deposits of a map with the same grid
+    void Add(const DoseMap &_other);
+    void Clear();
+
+private:
+    static constexpr double Scale = 65536.;
+    static std::int64_t ToFixed(double _e) { return std::int64_t(_e * Scale + (_e < 0 ? -0.5 : 0.5)); };
+    static double ToEnergy(std::int64_t _v) { return _v / Scale; };
+
+    void Deposit(double _x, double _y, double _z, std::int64_t _e);
+
+    double fMin[3];
+    double fWidth[3];
+    double fInvWidth[3];
+    std::size_t fN[3];
+    double fWork;
+
+    std::vector<std::int64_t> fEnergy;
+    std::int64_t fTotal;
+    std::int64_t fOutside;
+};
+
+template <typename Collision>
+void DoseMap::Fill(const Collision &_col)
+{
+    const auto &pos = _col.GetPosition();
+    const double x = pos.X();
+    const double y = pos.Y();
+    const double z = pos.Z();
+
+    if (_col.GetRecoilEnergy() > 0)
+        Fill(x, y, z, _col.GetRecoilEnergy());
+
+    const double dr = _col.GetDistanceToNextCollision();
+    const auto &dir = _col.GetScatteringDirection();
+    if (_col.GetEnergyLoss() > 0)
+        FillSegment(x, y, z, dr * dir.X(), dr * dir.Y(), dr * dir.Z(), _col.GetEnergyLoss());
+}
+
+// Generate one track per request on a work-stealing thread pool and
+// accumulate their deposits on the grid of _grid (its contents are kept and added to).
+// Collisions are pulled block by block and binned at once: no track or cluster is stored.
+// Every worker owns a copy of _prototype and of the grid, reduced at the end.
+// Request #i uses track index _prototype.GetTrackIndex() + i as in GenerateMany(),
+// and the result is the same for any number of threads.
+template <typename Generator>
+DoseMap AccumulateDose(const Generator &_prototype,
+                       const std::vector<TrackRequest> &_requests,
+                       const DoseMap &_grid,
+                       int _nThreads = 0)
+{
+    if (!_prototype.IsAccesible())
+    {
+        throw std::runtime_error("AccumulateDose() :: DB " + _prototype.GetFileName() + " is not accessible...");
+    }
+
+    WorkStealingPool pool(_nThreads);
+    std::vector<Generator> generators(pool.GetNumberOfThreads(), _prototype);
+    DoseMap empty(_grid);
+    empty.Clear();
+    std::vector<DoseMap> maps(pool.GetNumberOfThreads(), empty);
+    const std::uint64_t firstIndex = _prototype.GetTrackIndex();
+
+    pool.Run(_requests.size(), [&](int _worker, std::size_t _i) {
+        auto &gen = generators[_worker];
+        auto &map = maps[_worker];
+        const auto &req = _requests[_i];
+        gen.SetTrackIndex(firstIndex + _i);
+        gen.Begin(req.fEkin, req.fX, req.fY, req.fZ, req.fDx, req.fDy, req.fDz);
+        for (;;)
+        {
+            const auto cols = gen.Next(64);
+            if (cols.empty())
+                break;
+            for (const auto &col : cols)
+                map.Fill(col);
+        }
+    });
+
+    DoseMap result(_grid);
+    for (const auto &map : maps)
+        result.Add(map);
+    return result;
+}
+
+// _n tracks with identical initial conditions
+template <typename Generator>
+DoseMap AccumulateDose(const Generator &_prototype, std::size_t _n,
+                       double _ekin, double _x, double _y, double _z,
+                       double _dx, double _dy, double _dz,
+                       const DoseMap &_grid,
+                       int _nThreads = 0)
+{
+    std::vector<TrackRequest> requests(_n, TrackRequest(_ekin, _x, _y, _z, _dx, _dy, _dz));
+    return AccumulateDose(_prototype, requests, _grid, _nThreads);
+}
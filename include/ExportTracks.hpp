@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "TrackTreeFile.hpp"
+
+// Write every track of the collision DB _dbName as one entry of the "tr" tree of _fileName,
+// in the layout of TrackTreeFile with _schema (with the "species" tree, the compression
+// and the basket and auto-flush sizes of TrackTreeFile for Schema::Compact).
+// Ranges of _tracksPerTask track IDs are read, decoded and compressed on _nThreads threads,
+// each with its own DB connection and ParallelTreeFile writer.
+// The entries are in no particular order (track_id tells them apart).
+// Returns the number of tracks written.
+std::size_t ExportTracks(const std::string &_dbName, const std::string &_fileName,
+                         TrackTreeFile::Schema _schema = TrackTreeFile::Schema::Full,
+                         int _nThreads = 0, std::size_t _tracksPerTask = 256);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "TrackGenerator.hpp"
+#include "WorkStealingPool.hpp"
+
+// Initial condition of one track
+struct TrackRequest
+{
+    TrackRequest()
+        : fEkin(0), fX(0), fY(0), fZ(0), fDx(1), fDy(0), fDz(0){};
+    TrackRequest(double _fEkin, double _fX, double _fY, double _fZ,
+                 double _fDx, double _fDy, double _fDz)
+        : fEkin(_fEkin), fX(_fX), fY(_fY), fZ(_fZ),
+          fDx(_fDx), fDy(_fDy), fDz(_fDz){};
+
+    double fEkin;
+    double fX, fY, fZ;
+    double fDx, fDy, fDz;
+};
+
+// Generate one track per request on a work-stealing thread pool.
+// Every worker thread owns a copy of _prototype (DB connection, random stream).
+// Request #i is generated with track index _prototype.GetTrackIndex() + i,
+// so the output is ordered and identical for any number of threads.
+template <typename Generator>
+std::vector<typename Generator::CollisionCollection>
+GenerateMany(const Generator &_prototype,
+             const std::vector<TrackRequest> &_requests,
+             int _nThreads = 0)
+{
+    if (!_prototype.IsAccesible())
+    {
+        throw std::runtime_error("GenerateMany() :: DB " + _prototype.GetFileName() + " is not accessible...");
+    }
+
+    WorkStealingPool pool(_nThreads);
+    std::vector<Generator> generators(pool.GetNumberOfThreads(), _prototype);
+    std::vector<typename Generator::CollisionCollection> tracks(_requests.size());
+    const std::uint64_t firstIndex = _prototype.GetTrackIndex();
+
+    pool.Run(_requests.size(), [&](int _worker, std::size_t _i) {
+        auto &gen = generators[_worker];
+        const auto &req = _requests[_i];
+        gen.SetTrackIndex(firstIndex + _i);
+        tracks[_i] = gen.Generate(req.fEkin, req.fX, req.fY, req.fZ,
+                                  req.fDx, req.fDy, req.fDz);
+    });
+
+    return tracks;
+}
+
+// _n tracks with identical initial conditions
+template <typename Generator>
+std::vector<typename Generator::CollisionCollection>
+GenerateMany(const Generator &_prototype, std::size_t _n,
+             double _ekin, double _x, double _y, double _z,
+             double _dx, double _dy, double _dz,
+             int _nThreads = 0)
+{
+    std::vector<TrackRequest> requests(_n, TrackRequest(_ekin, _x, _y, _z, _dx, _dy, _dz));
+    return GenerateMany(_prototype, requests, _nThreads);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Sensor.hh"
+
+namespace Garfield
+{
+    class Geometry;
+}
+
+namespace GarfieldSuppl
+{
+
+    /// Voxelized map of the ionisable media in a box of the sensor.
+    /// The medium is sampled at the corners and the centre of every voxel:
+    /// voxels where all samples see the same medium are stored as ionisable or not,
+    /// the others contain a boundary and are left to an exact Sensor::GetMedium query.
+    /// Without a geometry, a solid that fits between the samples of a voxel
+    /// (thinner than the resolution) is missed and the voxel gets the medium around it.
+    /// With a geometry, every voxel overlapping the bounding box of one of its solids
+    /// is a boundary voxel, except for solids enclosing the whole box (e.g. the gas volume),
+    /// which are sampled only.
+    /// The map is a snapshot: Clear and Build again after the media or the solids changed.
+    class MediumVoxelMap
+    {
+    public:
+        enum State : std::uint8_t
+        {
+            Outside = 0, ///< out of the map
+            Ionisable,
+            NotIonisable, ///< not ionisable or no medium
+            Boundary      ///< exact query needed
+        };
+
+        MediumVoxelMap() = default;
+
+        /// Sample the media of the sensor in the box with voxels of about resolution [cm].
+        /// geometry (optional) : the solids of the sensor, see above.
+        bool Build(Garfield::Sensor *sensor,
+                   const double xmin, const double ymin, const double zmin,
+                   const double xmax, const double ymax, const double zmax,
+                   const double resolution,
+                   const Garfield::Geometry *geometry = nullptr);
+
+        void Clear();
+
+        bool IsBuilt() const { return !m_state.empty(); }
+
+        /// Built from the same sensor, geometry, box and resolution.
+        /// Changes inside the sensor or the geometry are not detected.
+        bool Matches(const Garfield::Sensor *sensor,
+                     const double xmin, const double ymin, const double zmin,
+                     const double xmax, const double ymax, const double zmax,
+                     const double resolution,
+                     const Garfield::Geometry *geometry = nullptr) const
+        {
+            return IsBuilt() && sensor == m_sensor && geometry == m_geometry &&
+                   resolution == m_resolution &&
+                   xmin == m_xmin && ymin == m_ymin && zmin == m_zmin &&
+                   xmax == m_xmax && ymax == m_ymax && zmax == m_zmax;
+        }
+
+        State GetState(const double x, const double y, const double z) const
+        {
+            const double fx = (x - m_xmin) * m_invdx;
+            const double fy = (y - m_ymin) * m_invdy;
+            const double fz = (z - m_zmin) * m_invdz;
+            // Negated comparisons also reject NaN
+            if (!(fx >= 0 && fx < m_nx && fy >= 0 && fy < m_ny && fz >= 0 && fz < m_nz))
+                return Outside;
+            const std::size_t i = fx, j = fy, k = fz;
+            return State(m_state[(k * m_ny + j) * m_nx + i]);
+        }
+
+        std::size_t GetNumberOfVoxels() const { return m_state.size(); }
+        std::size_t GetNumberOfBoundaryVoxels() const { return m_nBoundary; }
+
+    private:
+        const Garfield::Sensor *m_sensor = nullptr;
+        const Garfield::Geometry *m_geometry = nullptr;
+        double m_resolution = 0.;
+        double m_xmin = 0., m_ymin = 0., m_zmin = 0.;
+        double m_xmax = 0., m_ymax = 0., m_zmax = 0.;
+        double m_invdx = 0., m_invdy = 0., m_invdz = 0.;
+        std::size_t m_nx = 0, m_ny = 0, m_nz = 0;
+        std::size_t m_nBoundary = 0;
+        std::vector<std::uint8_t> m_state;
+    };
+}
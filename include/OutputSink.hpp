@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "Span.hpp"
+#include "TRIM2SQLite.hpp"
+
+// Destination of generated tracks, one entry per track:
+// TrackTreeFile (ROOT) or TrackColumnarFile (ColumnarFile.hpp, no ROOT needed)
+class TrackSink
+{
+public:
+    virtual ~TrackSink(){};
+
+    virtual bool IsOpen() const = 0;
+
+    virtual void Fill(Span<const TRIM2SQLite::CollisionRecord> _track) = 0;
+    void Fill(const std::vector<TRIM2SQLite::CollisionRecord> &_track)
+    {
+        Fill(Span<const TRIM2SQLite::CollisionRecord>(_track));
+    };
+
+    // Complete the output (done by the destructors if not called)
+    virtual void Write() = 0;
+    virtual bool IsWritten() const = 0;
+};
+
+// Parallel arrays of the clusters of one track
+struct ClusterColumns
+{
+    Span<const double> x, y, z, t;
+    Span<const double> ec;      // energy spent to make the cluster
+    Span<const double> kinetic; // ion energy when the cluster was created
+    Span<const int> electrons;
+
+    ClusterColumns(){};
+    // Arrays of the same names (TrackTrimSQLite::GetClusters(), ...)
+    template <typename Clusters>
+    ClusterColumns(const Clusters &_clusters)
+        : x(_clusters.x), y(_clusters.y), z(_clusters.z), t(_clusters.t),
+          ec(_clusters.ec), kinetic(_clusters.kinetic), electrons(_clusters.electrons){};
+
+    std::size_t size() const { return x.size(); };
+};
+
+// Destination of the clusters, one entry per track:
+// ClusterTreeFile (ROOT) or ClusterColumnarFile (ColumnarFile.hpp)
+class ClusterSink
+{
+public:
+    virtual ~ClusterSink(){};
+
+    virtual bool IsOpen() const = 0;
+
+    virtual void Fill(const ClusterColumns &_clusters) = 0;
+
+    virtual void Write() = 0;
+    virtual bool IsWritten() const = 0;
+};
+
+// Angle [deg] between the incident directions of two consecutive collisions
+// ("th" of the track outputs, -1000 if one of them is null)
+inline double ScatteringAngle(double _x_f, double _y_f, double _z_f,
+                              double _x_l, double _y_l, double _z_l)
+{
+    const double inner_prd = _x_f * _x_l + _y_f * _y_l + _z_f * _z_l;
+    const double amp_f = sqrt(_x_f * _x_f + _y_f * _y_f + _z_f * _z_f);
+    const double amp_l = sqrt(_x_l * _x_l + _y_l * _y_l + _z_l * _z_l);
+
+    if (amp_f > 0 && amp_l > 0)
+        return acos(inner_prd / amp_f / amp_l) / M_PI * 180;
+    return -1000;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <RVersion.h>
+#include <TTree.h>
+#include <ROOT/TBufferMerger.hxx>
+
+// One ROOT file with one tree written by several threads.
+// Every thread fills the tree of its own Writer in memory (compression included);
+// the filled buffers are handed to the merger of ROOT (TBufferMerger),
+// which appends them to the tree in the file. Only that last step is serial,
+// so the output scales with the number of filling threads.
+// Entries of different writers are interleaved in the order their buffers arrive.
+//
+// The writers must be destroyed before the ParallelTreeFile,
+// which completes the file in its destructor.
+class ParallelTreeFile
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 26, 0)
+    using Merger = ROOT::TBufferMerger;
+    using MergerFile = ROOT::TBufferMergerFile;
+#else
+    using Merger = ROOT::Experimental::TBufferMerger;
+    using MergerFile = ROOT::Experimental::TBufferMergerFile;
+#endif
+
+public:
+    // _compression : ROOT compression setting (algorithm * 100 + level), the default of ROOT if negative
+    ParallelTreeFile(const std::string &_fileName,
+                     const std::string &_treeName, const std::string &_treeTitle = "",
+                     int _compression = -1);
+
+    const std::string &GetTreeName() const { return fTreeName; };
+
+    // Entries a writer keeps before sending them to the merger
+    void SetEntriesPerFlush(long _fEntriesPerFlush) { fEntriesPerFlush = _fEntriesPerFlush; };
+    long GetEntriesPerFlush() const { return fEntriesPerFlush; };
+
+    // Tree of one thread. Branches are created on GetTree() by the caller
+    // on buffers of that thread.
+    class Writer
+    {
+    public:
+        // Sends the remaining entries
+        ~Writer();
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        TTree &GetTree() { return *fTree; };
+
+        void Fill();
+        // Send the entries filled since the last flush to the merger
+        void Flush();
+
+        long GetEntries() const { return fEntries; };
+
+    private:
+        friend class ParallelTreeFile;
+        Writer(std::shared_ptr<MergerFile> _file,
+               const std::string &_treeName, const std::string &_treeTitle,
+               long _entriesPerFlush);
+
+        std::shared_ptr<MergerFile> fFile;
+        TTree *fTree; // owned by fFile
+        long fEntriesPerFlush;
+        long fEntries;
+        long fPending;
+    };
+
+    // Writer for one thread (may be called from any thread)
+    std::unique_ptr<Writer> MakeWriter();
+    // Writer of another tree in the same file
+    std::unique_ptr<Writer> MakeWriter(const std::string &_treeName, const std::string &_treeTitle);
+
+private:
+    std::string fTreeName;
+    std::string fTreeTitle;
+    long fEntriesPerFlush;
+    std::unique_ptr<Merger> fMerger;
+};
+
+// Writer with the branches of Entry (TrackTreeEntry, ClusterTreeEntry, ...)
+//     ParallelTreeFile file("tracks.root", "tr", "tracks");
+//     // on each thread
+//     ParallelTreeWriter<TrackTreeEntry> writer(file);
+//     writer.Fill(track);
+template <typename Entry>
+class ParallelTreeWriter
+{
+public:
+    explicit ParallelTreeWriter(ParallelTreeFile &_file)
+        : fWriter(_file.MakeWriter()), fEntry()
+    {
+        fEntry.Branch(fWriter->GetTree());
+    };
+    // Writer of another tree in the same file
+    ParallelTreeWriter(ParallelTreeFile &_file, const std::string &_treeName, const std::string &_treeTitle)
+        : fWriter(_file.MakeWriter(_treeName, _treeTitle)), fEntry()
+    {
+        fEntry.Branch(fWriter->GetTree());
+    };
+    ParallelTreeWriter(const ParallelTreeWriter &) = delete;
+    ParallelTreeWriter &operator=(const ParallelTreeWriter &) = delete;
+
+    Entry &GetEntry() { return fEntry; };
+    TTree &GetTree() { return fWriter->GetTree(); };
+
+    // Fill the entry as it is
+    void Fill() { fWriter->Fill(); };
+    // Assign _data to the entry and fill it
+    template <typename Data>
+    void Fill(const Data &_data)
+    {
+        fEntry.Assign(_data);
+        fWriter->Fill();
+    };
+
+    void Flush() { fWriter->Flush(); };
+    long GetEntries() const { return fWriter->GetEntries(); };
+
+private:
+    std::unique_ptr<ParallelTreeFile::Writer> fWriter;
+    Entry fEntry;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+
+// Non-owning view of a contiguous array (std::span is C++20)
+template <typename T>
+class Span
+{
+public:
+    using value_type = T;
+    using iterator = T *;
+
+    Span() : fData(nullptr), fSize(0){};
+    Span(T *_fData, std::size_t _fSize) : fData(_fData), fSize(_fSize){};
+
+    // View of a whole container with data() and size() (std::vector, ...)
+    template <typename Container>
+    Span(Container &_container) : fData(_container.data()), fSize(_container.size()){};
+
+    T *data() const { return fData; };
+    std::size_t size() const { return fSize; };
+    bool empty() const { return fSize == 0; };
+
+    T *begin() const { return fData; };
+    T *end() const { return fData + fSize; };
+
+    T &operator[](std::size_t _i) const { return fData[_i]; };
+
+    T &at(std::size_t _i) const
+    {
+        if (_i >= fSize)
+            throw std::out_of_range("Span::at");
+        return fData[_i];
+    };
+
+    Span subspan(std::size_t _offset, std::size_t _count) const
+    {
+        if (_offset > fSize || _count > fSize - _offset)
+            throw std::out_of_range("Span::subspan");
+        return Span(fData + _offset, _count);
+    };
+
+private:
+    T *fData;
+    std::size_t fSize;
+};
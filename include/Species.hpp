@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+// Species codes of ions and target atoms in the output files:
+// the atomic number of the element symbol written by SRIM ("He" -> 2).
+// 0 is used for names that are not an element.
+namespace Species
+{
+    // Codes 1 to NumberOfCodes - 1 are the elements H to Og
+    constexpr int NumberOfCodes = 119;
+
+    // Atomic number of an element symbol, 0 if unknown
+    int GetCode(const std::string &_name);
+    // Element symbol of a code ("" if unknown)
+    const char *GetName(int _code);
+}
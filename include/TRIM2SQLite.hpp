@@ -87,6 +87,151 @@ private:
     }
 };
 
+// Record of one ion-atom collision.
+// Real is the scalar type of positions and directions (double or float);
+// energies, step lengths and energy losses are kept in double.
+template <typename Real>
+class BasicCollisionRecord
+{
+    template <typename>
+    friend class BasicCollisionRecord;
+
+public:
+    BasicCollisionRecord(){};
+
+    // Conversion between scalar types
+    template <typename Real2>
+    explicit BasicCollisionRecord(const BasicCollisionRecord<Real2> &_rec)
+        : fTrackID(_rec.fTrackID), fCollisionID(_rec.fCollisionID),
+          fIncidentEnergy(_rec.fIncidentEnergy), fIncidentIon(_rec.fIncidentIon),
+          fMassNumber(_rec.fMassNumber), fRecoilIon(_rec.fRecoilIon),
+          fRecoilEnergy(_rec.fRecoilEnergy),
+          fPosition(_rec.fPosition.fX, _rec.fPosition.fY, _rec.fPosition.fZ),
+          fIncidentDirection(_rec.fIncidentDirection.fX, _rec.fIncidentDirection.fY, _rec.fIncidentDirection.fZ),
+          fScatteringDirection(_rec.fScatteringDirection.fX, _rec.fScatteringDirection.fY, _rec.fScatteringDirection.fZ),
+          fDistanceToNextCollision(_rec.fDistanceToNextCollision),
+          fEnergyLoss(_rec.fEnergyLoss){};
+
+    struct xyz
+    {
+        xyz() : fX(0), fY(0), fZ(0){};
+        xyz(Real _fX, Real _fY, Real _fZ)
+            : fX(_fX), fY(_fY), fZ(_fZ){};
+
+        Real X() const { return fX; };
+        Real Y() const { return fY; };
+        Real Z() const { return fZ; };
+        Real fX, fY, fZ;
+    };
+
+    void SetTrackID(int _fTrackID) { fTrackID = _fTrackID; }
+    void SetCollisionID(int _fCollisionID) { fCollisionID = _fCollisionID; }
+    void SetIncidentEnergy(double _fIncidentEnergy) { fIncidentEnergy = _fIncidentEnergy; }
+    void SetIncidentIon(const std::string &_fIncidentIon) { fIncidentIon = _fIncidentIon; }
+    void SetMassNumber(int _fMassNumber) { fMassNumber = _fMassNumber; };
+    void SetRecoilIon(const std::string &_fRecoilIon) { fRecoilIon = _fRecoilIon; }
+    void SetRecoilEnergy(double _fRecoilEnergy) { fRecoilEnergy = _fRecoilEnergy; }
+    void SetPosition(Real _x, Real _y, Real _z)
+    {
+        fPosition = xyz(_x, _y, _z);
+    }
+
+    void SetIncidentDirection(Real _dx, Real _dy, Real _dz)
+    {
+        Real norm = std::sqrt(_dx * _dx + _dy * _dy + _dz * _dz);
+        if (norm > 0)
+            fIncidentDirection = xyz(_dx / norm, _dy / norm, _dz / norm);
+        else
+            fIncidentDirection = xyz(0, 0, 0);
+    }
+    void SetScatteringDirection(Real _dx, Real _dy, Real _dz)
+    {
+        Real norm = std::sqrt(_dx * _dx + _dy * _dy + _dz * _dz);
+        if (norm > 0)
+            fScatteringDirection = xyz(_dx / norm, _dy / norm, _dz / norm);
+        else
+            fScatteringDirection = xyz(0, 0, 0);
+    }
+
+    void SetPosition(xyz &_vec)
+    {
+        SetPosition(_vec.X(), _vec.Y(), _vec.Z());
+    }
+
+    void SetIncidentDirection(xyz &_vec)
+    {
+        SetIncidentDirection(_vec.X(), _vec.Y(), _vec.Z());
+    }
+
+    void SetScatteringDirection(xyz &_vec)
+    {
+        SetScatteringDirection(_vec.X(), _vec.Y(), _vec.Z());
+    }
+
+    // Directions must already be unit (or zero) vectors
+    void SetKinematics(const xyz &_fPosition,
+                       const xyz &_fIncidentDirection,
+                       const xyz &_fScatteringDirection)
+    {
+        fPosition = _fPosition;
+        fIncidentDirection = _fIncidentDirection;
+        fScatteringDirection = _fScatteringDirection;
+    }
+
+    void SetDistanceToNextCollision(double _fDistanceToNextCollision)
+    {
+        fDistanceToNextCollision = _fDistanceToNextCollision;
+    }
+    void SetEnergyLoss(double _fEnergyLoss)
+    {
+        fEnergyLoss = _fEnergyLoss;
+    }
+
+    int GetTrackID() const { return fTrackID; }
+    int GetCollisionID() const { return fCollisionID; }
+
+    double GetIncidentEnergy() const { return fIncidentEnergy; }
+    const std::string &GetIncidentIon() const { return fIncidentIon; }
+    int GetMassNumber() const { return fMassNumber; };
+    const std::string &GetRecoilIon() const { return fRecoilIon; }
+    double GetRecoilEnergy() const { return fRecoilEnergy; }
+    const xyz &GetPosition() const
+    {
+        return fPosition;
+    }
+
+    const xyz &GetIncidentDirection() const
+    {
+        return fIncidentDirection;
+    }
+    const xyz &GetScatteringDirection() const
+    {
+        return fScatteringDirection;
+    }
+    double GetDistanceToNextCollision() const
+    {
+        return fDistanceToNextCollision;
+    }
+    double GetEnergyLoss() const
+    {
+        return fEnergyLoss;
+    }
+
+private:
+    int fTrackID;
+    int fCollisionID;
+    double fIncidentEnergy;
+    std::string fIncidentIon;
+    int fMassNumber;
+    std::string fRecoilIon;
+    double fRecoilEnergy;
+    xyz fPosition;
+    xyz fIncidentDirection;
+    xyz fScatteringDirection;
+    double fDistanceToNextCollision;
+    double fEnergyLoss; // De due to electrons, except for one from collision w/ atom
+};
+
 class TRIM2SQLite
 {
 public:
@@ -94,122 +239,11 @@ public:
 
     bool MakeSQLiteFile(const std::string &_path, const std::string &_outputname);
 
-    class CollisionRecord
-    {
-    public:
-        CollisionRecord(){};
-
-        struct xyz
-        {
-            xyz() : fX(0), fY(0), fZ(0){};
-            xyz(double _fX, double _fY, double _fZ)
-                : fX(_fX), fY(_fY), fZ(_fZ){};
-
-            double X() const { return fX; };
-            double Y() const { return fY; };
-            double Z() const { return fZ; };
-            double fX, fY, fZ;
-        };
-
-        void SetTrackID(int _fTrackID) { fTrackID = _fTrackID; }
-        void SetCollisionID(int _fCollisionID) { fCollisionID = _fCollisionID; }
-        void SetIncidentEnergy(double _fIncidentEnergy) { fIncidentEnergy = _fIncidentEnergy; }
-        void SetIncidentIon(const std::string &_fIncidentIon) { fIncidentIon = _fIncidentIon; }
-        void SetMassNumber(int _fMassNumber) { fMassNumber = _fMassNumber; };
-        void SetRecoilIon(const std::string &_fRecoilIon) { fRecoilIon = _fRecoilIon; }
-        void SetRecoilEnergy(double _fRecoilEnergy) { fRecoilEnergy = _fRecoilEnergy; }
-        void SetPosition(double _x, double _y, double _z)
-        {
-            fPosition = xyz(_x, _y, _z);
-        }
-
-        void SetIncidentDirection(double _dx, double _dy, double _dz)
-        {
-            double norm = std::sqrt(_dx * _dx + _dy * _dy + _dz * _dz);
-            if (norm > 0)
-                fIncidentDirection = xyz(_dx / norm, _dy / norm, _dz / norm);
-            else
-                fIncidentDirection = xyz(0, 0, 0);
-        }
-        void SetScatteringDirection(double _dx, double _dy, double _dz)
-        {
-            double norm = std::sqrt(_dx * _dx + _dy * _dy + _dz * _dz);
-            if (norm > 0)
-                fScatteringDirection = xyz(_dx / norm, _dy / norm, _dz / norm);
-            else
-                fScatteringDirection = xyz(0, 0, 0);
-        }
-
-        void SetPosition(xyz &_vec)
-        {
-            SetPosition(_vec.X(), _vec.Y(), _vec.Z());
-        }
-
-        void SetIncidentDirection(xyz &_vec)
-        {
-            SetIncidentDirection(_vec.X(), _vec.Y(), _vec.Z());
-        }
-
-        void SetScatteringDirection(xyz &_vec)
-        {
-            SetScatteringDirection(_vec.X(), _vec.Y(), _vec.Z());
-        }
-
-        void SetDistanceToNextCollision(double _fDistanceToNextCollision)
-        {
-            fDistanceToNextCollision = _fDistanceToNextCollision;
-        }
-        void SetEnergyLoss(double _fEnergyLoss)
-        {
-            fEnergyLoss = _fEnergyLoss;
-        }
-
-        int GetTrackID() const { return fTrackID; }
-        int GetCollisionID() const { return fCollisionID; }
-
-        double GetIncidentEnergy() const { return fIncidentEnergy; }
-        const std::string &GetIncidentIon() const { return fIncidentIon; }
-        int GetMassNumber() const { return fMassNumber; };
-        const std::string &GetRecoilIon() const { return fRecoilIon; }
-        double GetRecoilEnergy() const { return fRecoilEnergy; }
-        const xyz &GetPosition() const
-        {
-            return fPosition;
-        }
-
-        const xyz &GetIncidentDirection() const
-        {
-            return fIncidentDirection;
-        }
-        const xyz &GetScatteringDirection() const
-        {
-            return fScatteringDirection;
-        }
-        double GetDistanceToNextCollision() const
-        {
-            return fDistanceToNextCollision;
-        }
-        double GetEnergyLoss() const
-        {
-            return fEnergyLoss;
-        }
-
-    private:
-        int fTrackID;
-        int fCollisionID;
-        double fIncidentEnergy;
-        std::string fIncidentIon;
-        int fMassNumber;
-        std::string fRecoilIon;
-        double fRecoilEnergy;
-        xyz fPosition;
-        xyz fIncidentDirection;
-        xyz fScatteringDirection;
-        double fDistanceToNextCollision;
-        double fEnergyLoss; // De due to electrons, except for one from collision w/ atom
-    };
+    using CollisionRecord = BasicCollisionRecord<double>;
 
     static const std::string NameOfTable;
+    // Incident energy of every track (several TRIM runs can share one library)
+    static const std::string NameOfCatalog;
 
 private:
 };
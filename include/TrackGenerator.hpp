@@ -1,30 +1,92 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <vector>
 #include <string>
-#include <functional>
+#include <cstdint>
+#include <memory>
 
 #include "TRIM2SQLite.hpp"
 #include "CollisionDBHandler.hpp"
+#include "CollisionLibrary.hpp"
 #include "VectorAndMatrix.hpp"
+#include "CounterRandom.hpp"
+#include "TrackBatch.hpp"
 
-class TrackGenerator
+// Policies of BasicTrackGenerator (see below)
+namespace TrackPolicy
 {
+    class NoRotation;
+    class RandomPhiRotation;
+    class NoTransfer;
+    class RandomTransfer;
+    class TruncateAtEnergy;
+}
+
+// Library track converted to the scalar type of the generator
+template <typename Record>
+std::vector<Record> ConvertTrack(std::vector<TRIM2SQLite::CollisionRecord> &&_track)
+{
+    return std::vector<Record>(_track.begin(), _track.end());
+}
+
+template <>
+inline std::vector<TRIM2SQLite::CollisionRecord>
+ConvertTrack<TRIM2SQLite::CollisionRecord>(std::vector<TRIM2SQLite::CollisionRecord> &&_track)
+{
+    return std::move(_track);
+}
+
+// Library access, random stream and batch transform shared by all generators.
+// Real is the scalar type of the generated positions and directions.
+template <typename Real>
+class TrackGeneratorBase
+{
+    friend class TrackPolicy::NoRotation;
+    friend class TrackPolicy::RandomPhiRotation;
+    friend class TrackPolicy::NoTransfer;
+    friend class TrackPolicy::RandomTransfer;
+    friend class TrackPolicy::TruncateAtEnergy;
+
 public:
-    using Vector = TRIM2SQLite::CollisionRecord::xyz;
+    using Scalar = Real;
+    using Collision = BasicCollisionRecord<Real>;
+    using Vector = typename Collision::xyz;
     using Transform = Mm::Matrix<Vector>;
-    using Collision = TRIM2SQLite::CollisionRecord;
-    using CollisionCollection = std::vector<TRIM2SQLite::CollisionRecord>;
-    using CollisionIterator = CollisionCollection::iterator;
+    using CollisionCollection = std::vector<Collision>;
+    using CollisionIterator = typename CollisionCollection::iterator;
 
-    TrackGenerator()
-        : fFileName(), fRandomGenerator([]() { return 0; }),
-          fTrackIDMin(-1), fTrackIDMax(-1), fAccessibilityGood(false){};
+    // Substream of the (seed, track index) key used by the generator itself
+    static constexpr std::uint32_t RandomSubstream = 0;
 
-    TrackGenerator(const std::string &_fFileName)
-        : fFileName(), fRandomGenerator([]() { return 0; }),
-          fTrackIDMin(-1), fTrackIDMax(-1), fAccessibilityGood(false)
+    // Collisions [begin, end) of the current track handed out by Next()
+    class CollisionBlock
+    {
+    public:
+        CollisionBlock(CollisionIterator _fBegin, CollisionIterator _fEnd)
+            : fBegin(_fBegin), fEnd(_fEnd){};
+
+        CollisionIterator begin() const { return fBegin; };
+        CollisionIterator end() const { return fEnd; };
+        std::size_t size() const { return fEnd - fBegin; };
+        bool empty() const { return fBegin == fEnd; };
+
+    private:
+        CollisionIterator fBegin, fEnd;
+    };
+
+    TrackGeneratorBase()
+        : fFileName(), fConnection(), fLibrary(), fRandom(), fSeed(0), fTrackIndex(0),
+          fTrackIDMin(-1), fTrackIDMax(-1), fAccessibilityGood(false),
+          fTrack(), fNumberOfResolved(0){};
+
+    TrackGeneratorBase(const std::string &_fFileName)
+        : fFileName(), fConnection(), fLibrary(), fRandom(), fSeed(0), fTrackIndex(0),
+          fTrackIDMin(-1), fTrackIDMax(-1), fAccessibilityGood(false),
+          fTrack(), fNumberOfResolved(0)
     {
         auto ok = SetFileName(_fFileName);
         if (!ok)
@@ -33,22 +95,38 @@ public:
         }
     };
 
-    virtual CollisionCollection
-    Generate(double _ekin, double _x, double _y, double _z,
-             double _dx, double _dy, double _dz) = 0;
-
     bool SetFileName(const std::string &_fFileName)
     {
         fFileName = _fFileName;
+        fConnection.Close();
+        fLibrary.reset();
         return CheckAccessibility();
     };
 
-    std::string GetFileName() const { return fFileName; };
-    void SetRandomGenerator(const std::function<double()> &_fRandomGenerator)
+    // Read tracks from a library in memory instead of the DB file
+    // (e.g. CollisionLibrary::Open(), shared with other generators and threads).
+    // A null library detaches the generator.
+    void SetLibrary(std::shared_ptr<const CollisionLibrary> _fLibrary)
     {
-        fRandomGenerator = _fRandomGenerator;
+        fLibrary = std::move(_fLibrary);
+        fFileName = fLibrary ? fLibrary->GetFileName() : std::string();
+        fConnection.Close();
+        fAccessibilityGood = static_cast<bool>(fLibrary);
     };
 
+    const std::shared_ptr<const CollisionLibrary> &GetLibrary() const { return fLibrary; };
+
+    std::string GetFileName() const { return fFileName; };
+
+    // Random numbers of a track are keyed by (seed, track index).
+    // Generate() uses the current track index and then increments it,
+    // so SetTrackIndex(i) followed by Generate() reproduces track #i.
+    void SetSeed(std::uint64_t _fSeed) { fSeed = _fSeed; };
+    std::uint64_t GetSeed() const { return fSeed; };
+
+    void SetTrackIndex(std::uint64_t _fTrackIndex) { fTrackIndex = _fTrackIndex; };
+    std::uint64_t GetTrackIndex() const { return fTrackIndex; };
+
     void SetTrackIDMin(int _fTrackIDMin)
     {
         fTrackIDMin = _fTrackIDMin;
@@ -69,30 +147,47 @@ public:
         return fTrackIDMax;
     };
 
-    CollisionCollection GetTrackRandom()
+    // Incident energies held by the library (ascending)
+    std::vector<double> GetLibraryEnergies()
     {
-        CollisionDBHandler db(GetFileName());
-        int nTracks = db.GetNumberOfTracks();
+        if (fLibrary)
+        {
+            const auto energies = fLibrary->GetEnergies();
+            return std::vector<double>(energies.begin(), energies.end());
+        }
+        GetDB();
+        return fConnection.GetEnergies();
+    };
+
+    // Random track of the lowest library energy not below _ekin.
+    // It is truncated down to _ekin by the truncation policy afterwards.
+    CollisionCollection GetTrackRandom(double _ekin)
+    {
+        if (!fLibrary)
+            GetDB();
+        const Span<const int> trackIDs = fLibrary ? fLibrary->GetTrackIDs(_ekin)
+                                                  : Span<const int>(fConnection.GetTrackIDs(_ekin));
+        int nTracks = trackIDs.size();
+        int iMin = fTrackIDMin >= 0 ? std::lower_bound(trackIDs.begin(), trackIDs.end(), fTrackIDMin) - trackIDs.begin() : 0;
+        int iMax = fTrackIDMax >= 0 ? std::upper_bound(trackIDs.begin(), trackIDs.end(), fTrackIDMax) - trackIDs.begin() - 1 : nTracks - 1;
         int iTrack;
-        int iMin = fTrackIDMin >= 0 ? fTrackIDMin : 0;
-        int iMax = (0 <= fTrackIDMax && fTrackIDMax < nTracks) ? fTrackIDMax : nTracks - 1;
 
         if (iMin <= iMax)
-            iTrack = GetRandomInteger(iMin, iMax);
+            iTrack = trackIDs[GetRandomInteger(iMin, iMax)];
         else
         {
             std::cerr << "TrackGenerator::GetTracsRandom() :: Invalid index range -> use all tracks." << std::endl;
-            iTrack = GetRandomInteger(0, nTracks - 1);
+            iTrack = trackIDs[GetRandomInteger(0, nTracks - 1)];
         }
 
-        return db.GetTrack(iTrack);
+        return GetTrack(iTrack);
     };
 
     CollisionCollection GetTrack(int _trackID)
     {
-        CollisionDBHandler db(GetFileName());
-
-        return db.GetTrack(_trackID);
+        if (fLibrary)
+            return ConvertTrack<Collision>(fLibrary->GetTrack(_trackID));
+        return ConvertTrack<Collision>(GetDB().GetTrack(_trackID));
     };
 
     bool IsAccesible() const
@@ -102,6 +197,8 @@ public:
 
     bool CheckAccessibility()
     {
+        if (fLibrary)
+            return fAccessibilityGood = true;
         try
         {
             CollisionDBHandler db(GetFileName());
@@ -116,21 +213,98 @@ public:
     }
 
 private:
+    // DB connection opened on first use and kept for the lifetime of the generator.
+    // A copy opens its own connection, so each thread can own a generator copy.
+    class Connection
+    {
+    public:
+        Connection() : fpDB(), fEnergies(), fTrackIDs(){};
+        Connection(const Connection &) : fpDB(), fEnergies(), fTrackIDs(){};
+        Connection &operator=(const Connection &)
+        {
+            Close();
+            return *this;
+        };
+
+        CollisionDBHandler &Get(const std::string &_fileName)
+        {
+            if (!fpDB)
+                fpDB.reset(new CollisionDBHandler(_fileName));
+            return *fpDB;
+        };
+
+        const std::vector<double> &GetEnergies()
+        {
+            BuildIndex();
+            return fEnergies;
+        };
+
+        // Track IDs (ascending) of the lowest library energy not below _ekin
+        const std::vector<int> &GetTrackIDs(double _ekin)
+        {
+            BuildIndex();
+            auto it = std::lower_bound(fEnergies.begin(), fEnergies.end(), _ekin);
+            if (it == fEnergies.end())
+                throw std::runtime_error("Kinetic energy out of range.");
+            return fTrackIDs[it - fEnergies.begin()];
+        };
+
+        void Close()
+        {
+            fpDB.reset();
+            fEnergies.clear();
+            fTrackIDs.clear();
+        };
+
+    private:
+        // Energy index of the catalog, read once per connection
+        void BuildIndex()
+        {
+            if (!fEnergies.empty())
+                return;
+            for (const auto &rec : fpDB->GetCatalog())
+            {
+                if (fEnergies.empty() || fEnergies.back() != rec.fEnergy)
+                {
+                    fEnergies.push_back(rec.fEnergy);
+                    fTrackIDs.emplace_back();
+                }
+                fTrackIDs.back().push_back(rec.fTrackID);
+            }
+        };
+
+        std::unique_ptr<CollisionDBHandler> fpDB;
+        std::vector<double> fEnergies;
+        std::vector<std::vector<int>> fTrackIDs;
+    };
+
     std::string fFileName;
-    std::function<double()> fRandomGenerator;
+    Connection fConnection;
+    // Shared read-only library (tracks are read from the DB file if null)
+    std::shared_ptr<const CollisionLibrary> fLibrary;
+    Mm::CounterRandom fRandom;
+    std::uint64_t fSeed;
+    std::uint64_t fTrackIndex;
     int fTrackIDMin, fTrackIDMax;
     bool fAccessibilityGood;
 
 protected:
+    CollisionDBHandler &GetDB()
+    {
+        return fConnection.Get(GetFileName());
+    };
+
+    // Key the random stream to the current track index and advance the index
+    void BeginTrack()
+    {
+        fRandom.Reset(fSeed, fTrackIndex, RandomSubstream);
+        ++fTrackIndex;
+    };
+
+    // Uniform in [0, 1)
     double Random()
     {
-        double val = fRandomGenerator();
-        if (val < 0)
-            return 0;
-        else if (val > 1)
-            return 1;
-        else
-            return val;
+        return fRandom.Uniform();
     };
 
     int GetRandomInteger(int _min, int _max)
@@ -141,215 +315,307 @@ protected:
         int a = min + Random() * (max - min + 1);
         return a < max ? a : max;
     }
-};
 
-class TrackGeneratorA : public TrackGenerator
-{
-public:
-    TrackGeneratorA()
-        : TrackGenerator(){};
+    // Bring collisions [_first, fNumberOfResolved) of fTrack to the lab frame in one batch.
+    // fTransforms[i] maps the scattering direction of collision #(_first + i) to the lab frame.
+    // Positions are accumulated from the first collision of the track and
+    // incident directions are taken from the scattering direction just before.
+    void TransformBlock(std::size_t _first);
+
+    // Current track : collisions before fNumberOfResolved are in the lab frame,
+    // the others are still library collisions (rotation and transfer not resolved yet).
+    CollisionCollection fTrack;
+    std::size_t fNumberOfResolved;
+    // Library frame -> lab frame at the last resolved collision
+    Transform fTransform;
+    // Lab-frame scattering direction of the last resolved collision
+    Vector fLastDirection;
+
+    // Per-collision transforms of the current block (reused between blocks)
+    std::vector<Transform> fTransforms;
+    BasicTrackBatch<Real> fBatch;
+};
 
-    TrackGeneratorA(const std::string &_fFileName)
-        : TrackGenerator(_fFileName){};
+using TrackGenerator = TrackGeneratorBase<double>;
 
-    virtual CollisionCollection
-    Generate(double _ekin, double _x, double _y, double _z,
-             double _dx, double _dy, double _dz)
+namespace TrackPolicy
+{
+    template <typename Real>
+    using Transform = typename TrackGeneratorBase<Real>::Transform;
+    template <typename Real>
+    using CollisionCollection = typename TrackGeneratorBase<Real>::CollisionCollection;
+    template <typename Real>
+    using CollisionIterator = typename TrackGeneratorBase<Real>::CollisionIterator;
+
+    // Rotation policy : library direction is kept
+    class NoRotation
     {
-        if (!IsAccesible())
-        {
-            throw std::runtime_error("Generate() :: DB " + GetFileName() + " is not accessible...");
-        }
-
-        if (_dx == 0 && _dy == 0 && _dz == 0)
-        {
-            throw std::runtime_error("Generate() :: Zero vector input");
-        }
-
-        auto track = GetTrackRandom();
-        EraseHighEnergyCollisionsFromTrack(track, _ekin);
+    protected:
+        template <typename Real>
+        void RotateFirst(TrackGeneratorBase<Real> &, CollisionIterator<Real>, Transform<Real> &){};
+        template <typename Real>
+        void Rotate(TrackGeneratorBase<Real> &, CollisionIterator<Real>, Transform<Real> &){};
+    };
 
-        Transform mat;
-        for (auto it = track.begin(); it != track.end(); ++it)
+    // Rotation policy : random phi-rotation at each collisions
+    class RandomPhiRotation
+    {
+    protected:
+        // _it is in the lab frame (first collision)
+        template <typename Real>
+        void RotateFirst(TrackGeneratorBase<Real> &_gen, CollisionIterator<Real> _it, Transform<Real> &_mat)
         {
-            if (it == track.begin())
+            auto dx0 = _it->GetIncidentDirection();
+            if (Mm::Normalize(dx0))
             {
-                mat = SetFirstCollision(it, _ekin, _x, _y, _z,
-                                        _dx, _dy, _dz);
+                auto dx1 = _it->GetScatteringDirection();
+                Real cs, sn;
+                auto random = [&_gen]() { return _gen.Random(); };
+                Mm::RandomUnitCircle(random, cs, sn);
+                dx1 = Mm::RotateUnitAxis(dx0, cs, sn, dx1);
+                Mm::Normalize(dx1);
+                _it->SetScatteringDirection(dx1);
+                _mat = Mm::MakeRotaionMatrixUnitAxis(dx0, cs, sn) * _mat;
+                _mat.Orthonormalize();
             }
+        };
 
-            else
+        // _it is still in the library frame:
+        // rotation about the lab-frame incident direction _mat * d0 equals
+        // _mat * R(d0), so the rotation is applied from the right.
+        template <typename Real>
+        void Rotate(TrackGeneratorBase<Real> &_gen, CollisionIterator<Real> _it, Transform<Real> &_mat)
+        {
+            auto dx0 = _it->GetIncidentDirection();
+            if (Mm::Normalize(dx0))
             {
-                AdaptCollision(it, mat);
+                Real cs, sn;
+                auto random = [&_gen]() { return _gen.Random(); };
+                Mm::RandomUnitCircle(random, cs, sn);
+                _mat = _mat * Mm::MakeRotaionMatrixUnitAxis(dx0, cs, sn);
+                _mat.Orthonormalize();
             }
-        }
-
-        return track;
+        };
     };
 
-protected:
-    void EraseHighEnergyCollisionsFromTrack(CollisionCollection &_track,
-                                            double _ekin);
-
-    Transform SetFirstCollision(CollisionIterator _it,
-                                double _ekin, double _x, double _y, double _z,
-                                double _dx, double _dy, double _dz) const;
-
-    // Adapt collision at _it to the collision just before
-    // _it must not be the first iterator
-    void AdaptCollision(CollisionIterator _it, Transform _mat);
-};
-
-// phi-rotation at each collisions
-class TrackGeneratorB : public TrackGeneratorA
-{
-public:
-    TrackGeneratorB()
-        : TrackGeneratorA(){};
-
-    TrackGeneratorB(const std::string &_fFileName)
-        : TrackGeneratorA(_fFileName){};
+    // Transfer policy : collision sequence of the library track is kept
+    class NoTransfer
+    {
+    protected:
+        template <typename Real>
+        void TryTransfer(TrackGeneratorBase<Real> &, CollisionCollection<Real> &,
+                         CollisionIterator<Real> &, Transform<Real> &){};
+    };
 
-    virtual CollisionCollection
-    Generate(double _ekin, double _x, double _y, double _z,
-             double _dx, double _dy, double _dz)
+    // Transfer policy : jump to another library track with similar energy
+    class RandomTransfer
     {
+    public:
+        RandomTransfer() : fTransferProbability(0), fEnergyMarginRatio(0.5){};
 
-        if (!IsAccesible())
+        double GetTransferProbability() const
         {
-            throw std::runtime_error("Generate() :: DB " + GetFileName() + " is not accessible...");
-        }
+            return fTransferProbability;
+        };
 
-        if (_dx == 0 && _dy == 0 && _dz == 0)
+        void SetTransferProbability(double _fTransferProbability)
         {
-            throw std::runtime_error("Generate()::Zero vector input");
-        }
+            if (0 <= _fTransferProbability &&
+                _fTransferProbability <= 1)
+                fTransferProbability = _fTransferProbability;
+        };
 
-        auto track = GetTrackRandom();
-        EraseHighEnergyCollisionsFromTrack(track, _ekin);
+        double GetEnergyMarginRatio() const { return fEnergyMarginRatio; };
+        void SetEnergyMarginRatio(double _fEnergyMarginRatio)
+        {
+            if (_fEnergyMarginRatio < 0)
+                fEnergyMarginRatio = 0;
+            else if (1 < _fEnergyMarginRatio)
+                fEnergyMarginRatio = 1;
+            else
+                fEnergyMarginRatio = _fEnergyMarginRatio;
+        };
 
-        Transform mat;
-        for (auto it = track.begin(); it != track.end(); ++it)
+    protected:
+        template <typename Real>
+        void TryTransfer(TrackGeneratorBase<Real> &_gen, CollisionCollection<Real> &_track,
+                         CollisionIterator<Real> &_it, Transform<Real> &_mat)
         {
-            if (it == track.begin())
+            // Kinetic energy after current collision
+            double ene = _it->GetIncidentEnergy() - _it->GetRecoilEnergy();
+            // Energy loss before next collision in current collision sequence
+            double de = _it->GetEnergyLoss();
+            // Distance to next collision in current collision sequence
+            double dr = _it->GetDistanceToNextCollision();
+            // Direction to next collision
+            auto dirScattering = _it->GetScatteringDirection();
+
+            //Transfer?
+            if (de > 0 &&
+                dr > 0 &&
+                Mm::Norm(dirScattering) > 0 &&
+                ene - de > 0 &&
+                _gen.Random() < GetTransferProbability())
             {
-                mat = SetFirstCollision(it, _ekin, _x, _y, _z,
-                                        _dx, _dy, _dz);
-
-                PhiRotationRandom(it, mat);
+                Transfer(_gen, _track, _it, _mat);
             }
+        };
 
-            else
-            {
-                AdaptCollision(it, mat);
-                PhiRotationRandom(it, mat);
-            }
-        }
+        template <typename Real>
+        CollisionCollection<Real> GetTransferDestinationCandidates(TrackGeneratorBase<Real> &_gen, double _ene,
+                                                                   double _ene_min, double _ene_max);
 
-        return track;
-    };
+        template <typename Real>
+        bool Transfer(TrackGeneratorBase<Real> &_gen, CollisionCollection<Real> &_track,
+                      CollisionIterator<Real> &_it, Transform<Real> &_mat);
 
-protected:
-    void PhiRotationRandom(CollisionIterator _it, Transform &_mat);
-};
+    private:
+        double fTransferProbability;
+        double fEnergyMarginRatio;
+    };
 
-class TrackGeneratorC : public TrackGeneratorB
+    // Truncation policy : start the library track where its energy matches _ekin
+    class TruncateAtEnergy
+    {
+    protected:
+        template <typename Real>
+        void EraseHighEnergyCollisionsFromTrack(CollisionCollection<Real> &_track,
+                                                double _ekin);
+
+        template <typename Real>
+        Transform<Real> SetFirstCollision(CollisionIterator<Real> _it,
+                                          double _ekin, double _x, double _y, double _z,
+                                          double _dx, double _dy, double _dz) const;
+
+        template <typename Real>
+        Transform<Real> Truncate(TrackGeneratorBase<Real> &, CollisionCollection<Real> &_track,
+                                 double _ekin, double _x, double _y, double _z,
+                                 double _dx, double _dy, double _dz)
+        {
+            EraseHighEnergyCollisionsFromTrack<Real>(_track, _ekin);
+            return SetFirstCollision<Real>(_track.begin(), _ekin, _x, _y, _z,
+                                           _dx, _dy, _dz);
+        };
+    };
+}
+
+// Generator composed at compile time from a rotation, a transfer and a truncation policy.
+// Each combination is a single loop without virtual call or run-time branch on the variant.
+template <typename RotationPolicy, typename TransferPolicy,
+          typename TruncationPolicy = TrackPolicy::TruncateAtEnergy,
+          typename Real = double>
+class BasicTrackGenerator : public TrackGeneratorBase<Real>,
+                            public RotationPolicy,
+                            public TransferPolicy,
+                            public TruncationPolicy
 {
 public:
-    TrackGeneratorC()
-        : TrackGeneratorB(), fTransferProbability(0), fEnergyMarginRatio(0.5){};
+    using Base = TrackGeneratorBase<Real>;
+    using typename Base::Transform;
+    using typename Base::CollisionCollection;
+
+    BasicTrackGenerator()
+        : Base(){};
+
+    BasicTrackGenerator(const std::string &_fFileName)
+        : Base(_fFileName){};
 
-    TrackGeneratorC(const std::string &_fFileName)
-        : TrackGeneratorB(_fFileName), fTransferProbability(0), fEnergyMarginRatio(0.5){};
+    using typename Base::CollisionBlock;
 
-    virtual CollisionCollection
+    // Whole track in the lab frame
+    CollisionCollection
     Generate(double _ekin, double _x, double _y, double _z,
              double _dx, double _dy, double _dz)
     {
+        Begin(_ekin, _x, _y, _z, _dx, _dy, _dz);
+        Next(std::numeric_limits<std::size_t>::max());
 
-        if (!IsAccesible())
+        CollisionCollection track;
+        track.swap(this->fTrack);
+        this->fNumberOfResolved = 0;
+        return track;
+    };
+
+    // Pull-based generation.
+    // Begin() draws a library track and places its first collision,
+    // then each Next() resolves the rotations and transfers of the following collisions
+    // and brings them to the lab frame. Collisions after the last block are left untouched,
+    // so the caller can stop early. The collisions are the same as from Generate().
+    void Begin(double _ekin, double _x, double _y, double _z,
+               double _dx, double _dy, double _dz)
+    {
+        if (!this->IsAccesible())
         {
-            throw std::runtime_error("Generate() :: DB " + GetFileName() + " is not accessible...");
+            throw std::runtime_error("Generate() :: DB " + this->GetFileName() + " is not accessible...");
         }
 
         if (_dx == 0 && _dy == 0 && _dz == 0)
         {
-            throw std::runtime_error("Generate()::Zero vector input");
+            throw std::runtime_error("Generate() :: Zero vector input");
         }
 
-        auto track = GetTrackRandom();
-        EraseHighEnergyCollisionsFromTrack(track, _ekin);
+        Base &base = *this;
+        this->BeginTrack();
+        this->fTrack = this->GetTrackRandom(_ekin);
+        this->fNumberOfResolved = 0;
 
-        Transform mat;
-        for (auto it = track.begin(); it != track.end(); ++it)
-        {
-            if (it == track.begin())
-            {
-                mat = SetFirstCollision(it, _ekin, _x, _y, _z,
-                                        _dx, _dy, _dz);
-
-                PhiRotationRandom(it, mat);
-            }
+        this->fTransform = this->Truncate(base, this->fTrack, _ekin, _x, _y, _z,
+                                          _dx, _dy, _dz);
+        this->RotateFirst(base, this->fTrack.begin(), this->fTransform);
+    };
 
-            else
+    // Next (at most) _n collisions in the lab frame, empty at the end of the track.
+    // The block is valid until the next call of Next(), Begin() or Generate().
+    CollisionBlock Next(std::size_t _n)
+    {
+        Base &base = *this;
+        auto &track = this->fTrack;
+        auto &transforms = this->fTransforms;
+        auto &mat = this->fTransform;
+        const std::size_t first = this->fNumberOfResolved;
+        std::size_t i = first;
+
+        transforms.clear();
+        for (; i < track.size() && i - first < _n; ++i)
+        {
+            // The first collision is already in the lab frame
+            if (i == 0)
             {
-                AdaptCollision(it, mat);
-                PhiRotationRandom(it, mat);
-
-                // Kinetic energy after current collision
-                double ene = it->GetIncidentEnergy() - it->GetRecoilEnergy();
-                // Energy loss before next collision in current collision sequence
-                double de = it->GetEnergyLoss();
-                // Distance to next collision in current collision sequence
-                double dr = it->GetDistanceToNextCollision();
-                // Direction to next collision
-                auto dirScattering = it->GetScatteringDirection();
-
-                //Transfer?
-                if (de > 0 &&
-                    dr > 0 &&
-                    Mm::Norm(dirScattering) > 0 &&
-                    ene - de > 0 &&
-                    Random() < GetTransferProbability())
-                {
-                    Transfer(track, it, mat);
-                }
+                transforms.push_back(Transform());
+                continue;
             }
+            auto it = track.begin() + i;
+            this->Rotate(base, it, mat);
+            transforms.push_back(mat);
+            this->TryTransfer(base, track, it, mat);
         }
+        this->fNumberOfResolved = i;
 
-        return track;
-    };
+        this->TransformBlock(first);
 
-    double GetTransferProbability() const
-    {
-        return fTransferProbability;
+        return CollisionBlock(track.begin() + first, track.begin() + i);
     };
+};
 
-    void SetTransferProbability(double _fTransferProbability)
-    {
-        if (0 <= _fTransferProbability &&
-            _fTransferProbability <= 1)
-            fTransferProbability = _fTransferProbability;
-    };
-
-    double GetEnergyMarginRatio() const { return fEnergyMarginRatio; };
-    void SetEnergyMarginRatio(double _fEnergyMarginRatio)
-    {
-        if (_fEnergyMarginRatio < 0)
-            fEnergyMarginRatio = 0;
-        else if (1 < _fEnergyMarginRatio)
-            fEnergyMarginRatio = 1;
-        else
-            fEnergyMarginRatio = _fEnergyMarginRatio;
-    };
-
-protected:
-    CollisionCollection GetTransferDestinationCandidates(double _ene,
-                                                         double _ene_min, double _ene_max);
-
-    bool Transfer(CollisionCollection &_track, CollisionIterator &_it, Transform &_mat);
+template <typename Real>
+using TrackGeneratorAT = BasicTrackGenerator<TrackPolicy::NoRotation, TrackPolicy::NoTransfer,
+                                             TrackPolicy::TruncateAtEnergy, Real>;
 
-private:
-    double fTransferProbability;
-    double fEnergyMarginRatio;
-};
+// phi-rotation at each collisions
+template <typename Real>
+using TrackGeneratorBT = BasicTrackGenerator<TrackPolicy::RandomPhiRotation, TrackPolicy::NoTransfer,
+                                             TrackPolicy::TruncateAtEnergy, Real>;
+
+// phi-rotation and transfer between library tracks
+template <typename Real>
+using TrackGeneratorCT = BasicTrackGenerator<TrackPolicy::RandomPhiRotation, TrackPolicy::RandomTransfer,
+                                             TrackPolicy::TruncateAtEnergy, Real>;
+
+using TrackGeneratorA = TrackGeneratorAT<double>;
+using TrackGeneratorB = TrackGeneratorBT<double>;
+using TrackGeneratorC = TrackGeneratorCT<double>;
+
+// Single precision positions and directions (about 1e-7 relative)
+using TrackGeneratorAFloat = TrackGeneratorAT<float>;
+using TrackGeneratorBFloat = TrackGeneratorBT<float>;
+using TrackGeneratorCFloat = TrackGeneratorCT<float>;
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <string>
 
@@ -8,21 +14,168 @@
 #include <TFile.h>
 
 #include "TRIM2SQLite.hpp"
+#include "Span.hpp"
+#include "Species.hpp"
+#include "OutputSink.hpp"
 
-class TrackTreeFile
+// Branches of one track ("tr" tree of TrackTreeFile), one entry per track
+struct TrackTreeEntry
+{
+    std::string ion;
+    int mass_number;
+    double ene0;
+    std::vector<int> track_id, collision_id;
+    std::vector<double> vX, vY, vZ, vEne;
+    // difference between next step (X == depth)
+    std::vector<double> vdR;
+    std::vector<double> vdX0, vdY0, vdZ0;
+    std::vector<double> vdX1, vdY1, vdZ1;
+    std::vector<double> vdEne;
+    std::vector<double> vTh;        // THeta == scattering angle
+    std::vector<std::string> vAtom; //Atom hit
+    std::vector<double> vRecoil;    // Recoil energy
+
+    TrackTreeEntry() : ion(), mass_number(0), ene0(0){};
+
+    // Create the branches of _tree on these buffers
+    void Branch(TTree &_tree);
+
+    void Assign(Span<const TRIM2SQLite::CollisionRecord> _track);
+    void Assign(const std::vector<TRIM2SQLite::CollisionRecord> &_track)
+    {
+        Assign(Span<const TRIM2SQLite::CollisionRecord>(_track));
+    };
+    void Clear();
+    void Reserve(std::size_t _n);
+    // Exchange the contents (the addresses of the members stay)
+    void Swap(TrackTreeEntry &_other);
+};
+
+// Branches of the clusters of one track (tree of testTrackTrimSQLite)
+struct ClusterTreeEntry
+{
+    std::vector<double> vx, vy, vz, vt;
+    std::vector<int> vn;
+    std::vector<double> ve_cls, ve_ion;
+
+    void Branch(TTree &_tree);
+
+    // Clusters with the parallel arrays x, y, z, t, electrons, ec, kinetic
+    // (TrackTrimSQLite::GetClusters())
+    template <typename Clusters>
+    void Assign(const Clusters &_clusters);
+    void Clear();
+};
+
+template <typename Clusters>
+void ClusterTreeEntry::Assign(const Clusters &_clusters)
+{
+    vx.assign(_clusters.x.begin(), _clusters.x.end());
+    vy.assign(_clusters.y.begin(), _clusters.y.end());
+    vz.assign(_clusters.z.begin(), _clusters.z.end());
+    vt.assign(_clusters.t.begin(), _clusters.t.end());
+    vn.assign(_clusters.electrons.begin(), _clusters.electrons.end());
+    ve_cls.assign(_clusters.ec.begin(), _clusters.ec.end());
+    ve_ion.assign(_clusters.kinetic.begin(), _clusters.kinetic.end());
+}
+
+// Compact layout of the "tr" tree (TrackTreeFile::Schema::Compact).
+// Positions, directions, step lengths and energies are single precision,
+// which rounds them by at most 2^-24 (6e-8) relative:
+//     positions  6 nm at 10 cm from the origin
+//     directions 6e-8 per component (about 1e-7 rad)
+//     energies   0.06 eV at 1 MeV
+// Ions and atoms are species codes (Species.hpp);
+// the "species" tree of the file lists code and name.
+// The scattering angle "th" is not stored (angle between consecutive dx0, dy0, dz0).
+struct CompactTrackTreeEntry
+{
+    int ion; // species code
+    int mass_number;
+    double ene0;
+    std::vector<int> track_id, collision_id;
+    std::vector<float> vX, vY, vZ, vEne;
+    std::vector<float> vdR;
+    std::vector<float> vdX0, vdY0, vdZ0;
+    std::vector<float> vdX1, vdY1, vdZ1;
+    std::vector<float> vdEne;
+    std::vector<unsigned char> vAtom; // species code of the atom hit
+    std::vector<float> vRecoil;
+
+    CompactTrackTreeEntry() : ion(0), mass_number(0), ene0(0){};
+
+    void Branch(TTree &_tree);
+
+    void Assign(Span<const TRIM2SQLite::CollisionRecord> _track);
+    void Assign(const std::vector<TRIM2SQLite::CollisionRecord> &_track)
+    {
+        Assign(Span<const TRIM2SQLite::CollisionRecord>(_track));
+    };
+    void Clear();
+    void Reserve(std::size_t _n);
+    void Swap(CompactTrackTreeEntry &_other);
+};
+
+// Branches of the "species" tree of Schema::Compact, one entry per species code
+struct SpeciesTreeEntry
+{
+    int code;
+    std::string name;
+
+    SpeciesTreeEntry() : code(0), name(){};
+
+    void Branch(TTree &_tree);
+    // Code _code and its name
+    void Assign(int _code);
+};
+
+// ROOT track sink: "tr" tree with one entry per track
+class TrackTreeFile : public TrackSink
 {
 public:
-    TrackTreeFile(const std::string &_fileName);
+    // Layout of the tree
+    enum class Schema
+    {
+        Full,   // TrackTreeEntry
+        Compact // CompactTrackTreeEntry, zstd compression
+    };
 
+    TrackTreeFile(const std::string &_fileName, Schema _schema = Schema::Full);
+
+    // Flushes the writer thread and writes the tree if not written yet
     ~TrackTreeFile();
 
-    bool IsOpen() const;
+    bool IsOpen() const override;
+
+    Schema GetSchema() const { return fSchema; };
+    // ROOT compression setting of Schema::Compact (negative : default of ROOT)
+    static int GetCompactCompression();
+    // Cluster and basket sizes of Schema::Compact for _tree (after its branches are made)
+    static void SetCompactTreeOptions(TTree &_tree);
+
+    // One entry per track. The branch buffers keep their capacity between calls,
+    // so filling tracks of similar length does not allocate.
+    void Fill(Span<const TRIM2SQLite::CollisionRecord> _track) override;
+    void Fill(const std::vector<TRIM2SQLite::CollisionRecord> &_track)
+    {
+        Fill(Span<const TRIM2SQLite::CollisionRecord>(_track));
+    };
 
-    void Fill(std::vector<TRIM2SQLite::CollisionRecord> _track);
+    // Run TTree::Fill (basket compression and I/O) on a writer thread.
+    // Fill() copies the track into one of _nBuffers entry buffers and returns;
+    // it waits while all of them are queued (2: double buffering).
+    // Errors of the writer thread are rethrown by the next Fill(), Flush() or Write().
+    void EnableAsyncWrite(std::size_t _nBuffers = 2);
+    // Flush and stop the writer thread
+    void DisableAsyncWrite();
+    bool IsAsyncWriteEnabled() const { return fWriter.joinable(); };
 
-    bool IsWritten() const { return fWritten; };
+    // Wait until every track handed to the writer thread is in the tree
+    void Flush();
 
-    void Write();
+    bool IsWritten() const override { return fWritten; };
+
+    void Write() override;
 
     void Clear();
 
@@ -31,18 +184,61 @@ private:
     TTree fTree;
 
     bool fWritten;
+    Schema fSchema;
 
-    std::string ion;
-    int mass_number;
-    double ene0;
-    std::vector<int> track_id, collision_id;
-    std::vector<double> vX, vY, vZ, vEne;
-    // difference between next step (X == depth)
-    std::vector<double> vdR;
-    std::vector<double> vdX0, vdY0, vdZ0;
-    std::vector<double> vdX1, vdY1, vdZ1;
-    std::vector<double> vdEne;
-    std::vector<double> vTh;        // THeta == scattering angle
-    std::vector<std::string> vAtom; //Atom hit
-    std::vector<double> vRecoil;    // Recoil energy
+    // Branch buffers of one entry in the layout of the schema
+    struct Buffer
+    {
+        virtual ~Buffer(){};
+        virtual void Branch(TTree &_tree) = 0;
+        virtual void Assign(Span<const TRIM2SQLite::CollisionRecord> _track) = 0;
+        virtual void Clear() = 0;
+        // Exchange the contents with a buffer of the same layout
+        virtual void Swap(Buffer &_other) = 0;
+        // Empty buffer of the same layout
+        virtual Buffer *New() const = 0;
+    };
+    template <typename Entry>
+    struct BufferOf;
+
+    // Buffers bound to the branches
+    std::unique_ptr<Buffer> fEntry;
+
+    // Writer thread : filled entries are swapped into fEntry there
+    std::thread fWriter;
+    std::mutex fMutex;
+    std::condition_variable fCondition;
+    std::size_t fNumberOfBuffers;
+    std::deque<std::unique_ptr<Buffer>> fQueue; // filled, oldest first
+    std::deque<std::unique_ptr<Buffer>> fFree;  // ready for Fill()
+    bool fStop;
+    std::exception_ptr fError;
+
+    void RunWriter();
+    // Code and name of every species (compact schema)
+    void WriteSpecies();
+    // Rethrow an error of the writer thread (with fMutex held)
+    void CheckWriter();
+};
+
+// ROOT cluster sink: tree of ClusterTreeEntry, one entry per track
+class ClusterTreeFile : public ClusterSink
+{
+public:
+    ClusterTreeFile(const std::string &_fileName, const std::string &_treeName = "tr");
+    // Writes the tree if not written yet
+    ~ClusterTreeFile();
+
+    bool IsOpen() const override;
+
+    void Fill(const ClusterColumns &_clusters) override;
+
+    bool IsWritten() const override { return fWritten; };
+    void Write() override;
+
+private:
+    TFile fFile;
+    TTree fTree;
+    ClusterTreeEntry fEntry;
+    bool fWritten;
 };
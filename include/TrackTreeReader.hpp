@@ -0,0 +1,191 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TTree.h>
+
+#include "Span.hpp"
+#include "WorkStealingPool.hpp"
+
+// Reader of the trees written by TrackTreeFile (any schema) or ParallelTreeFile.
+// Only the selected branches are enabled, bound and decompressed.
+// Every entry is presented as a View: one array per selected branch
+// (scalar branches as arrays of one value), valid until the next entry.
+//
+//     TrackTreeReader reader("tracks.root");
+//     reader.SetBranches({"x", "y", "z", "ene"});
+//     reader.ParallelForEach([&](int worker, const TrackTreeReader::View &view) {
+//         auto x = view.Get<double>(0); // float for Schema::Compact
+//         ...
+//     });
+class TrackTreeReader
+{
+    // Buffer bound to one branch
+    struct Slot
+    {
+        virtual ~Slot(){};
+        virtual void Bind(TTree &_tree, const char *_name) = 0;
+    };
+    // Object branch (std::vector<T>, std::string) : ROOT fills fObject through fPointer
+    template <typename T>
+    struct ObjectSlot : public Slot
+    {
+        T fObject;
+        T *fPointer = &fObject;
+        void Bind(TTree &_tree, const char *_name) override { _tree.SetBranchAddress(_name, &fPointer); };
+    };
+    // Leaf-list branch of one value ("mass_number/I", ...)
+    template <typename T>
+    struct ValueSlot : public Slot
+    {
+        T fValue = T();
+        void Bind(TTree &_tree, const char *_name) override { _tree.SetBranchAddress(_name, &fValue); };
+    };
+
+    // File, tree and buffers used by one thread
+    struct Source
+    {
+        std::unique_ptr<TFile> fFile;
+        TTree *fTree = nullptr;
+        std::vector<std::unique_ptr<Slot>> fSlots;
+    };
+
+public:
+    // Opens the file and selects all branches
+    TrackTreeReader(const std::string &_fileName, const std::string &_treeName = "tr");
+
+    const std::string &GetFileName() const { return fFileName; };
+    Long64_t GetEntries() const { return fMain->fTree->GetEntries(); };
+
+    // Branches in the tree
+    std::vector<std::string> GetBranchNames() const;
+
+    // Read only these branches; index i in the views is _names[i]
+    void SetBranches(const std::vector<std::string> &_names);
+    const std::vector<std::string> &GetBranches() const { return fBranches; };
+
+    // Largest number of entries given to a thread at a time by ParallelForEach
+    // (0 : one whole cluster, so that no two threads read the same baskets).
+    // Smaller ranges balance the threads better when a tree has few clusters,
+    // at the cost of reading and decompressing the baskets of a cluster more than once.
+    void SetEntriesPerTask(Long64_t _fEntriesPerTask) { fEntriesPerTask = _fEntriesPerTask; };
+
+    // Selected branches of one entry
+    class View
+    {
+    public:
+        Long64_t GetEntry() const { return fEntry; };
+        std::size_t GetNumberOfBranches() const { return fSlots->size(); };
+        // Index of a selected branch (throws if not selected)
+        std::size_t GetIndex(const std::string &_name) const;
+
+        // Values of branch _i. T is the element type of the branch :
+        // double or float for positions and energies, int, unsigned char or std::string
+        template <typename T>
+        Span<const T> Get(std::size_t _i) const;
+        template <typename T>
+        Span<const T> Get(const std::string &_name) const { return Get<T>(GetIndex(_name)); };
+
+    private:
+        friend class TrackTreeReader;
+        View(const std::vector<std::string> &_names, const Source &_source)
+            : fNames(&_names), fSlots(&_source.fSlots), fEntry(-1){};
+
+        const std::vector<std::string> *fNames;
+        const std::vector<std::unique_ptr<Slot>> *fSlots;
+        Long64_t fEntry;
+    };
+
+    // Read entry _entry on the calling thread
+    const View &Read(Long64_t _entry);
+
+    // Call _task(view) for every entry of [_begin, _end) in order (_end < 0 : all entries)
+    template <typename Task>
+    void ForEach(Task _task, Long64_t _begin = 0, Long64_t _end = -1);
+
+    // Call _task(worker, view) for every entry of [_begin, _end) on _nThreads threads.
+    // Every thread opens the file itself and reads ranges of consecutive entries
+    // (in order within a range, in no particular order between ranges).
+    // worker is in [0, number of threads) and identifies per-thread results.
+    template <typename Task>
+    void ParallelForEach(Task _task, int _nThreads = 0, Long64_t _begin = 0, Long64_t _end = -1);
+
+private:
+    std::string fFileName;
+    std::string fTreeName;
+    std::vector<std::string> fBranches;
+    Long64_t fEntriesPerTask;
+
+    // Source of the calling thread
+    std::unique_ptr<Source> fMain;
+    std::unique_ptr<View> fMainView;
+
+    static std::unique_ptr<Slot> MakeSlot(TBranch &_branch);
+    // Opens the file with the selected branches bound
+    std::unique_ptr<Source> Open() const;
+    void Read(Source &_source, Long64_t _entry) const;
+    // Entry ranges of at most _maxEntries entries, not crossing a cluster boundary
+    std::vector<std::pair<Long64_t, Long64_t>> GetRanges(Long64_t _begin, Long64_t _end,
+                                                         Long64_t _maxEntries) const;
+};
+
+template <typename T>
+Span<const T> TrackTreeReader::View::Get(std::size_t _i) const
+{
+    const Slot *slot = fSlots->at(_i).get();
+    if (const auto *vec = dynamic_cast<const ObjectSlot<std::vector<T>> *>(slot))
+        return Span<const T>(vec->fObject);
+    if (const auto *obj = dynamic_cast<const ObjectSlot<T> *>(slot))
+        return Span<const T>(&obj->fObject, 1);
+    if (const auto *value = dynamic_cast<const ValueSlot<T> *>(slot))
+        return Span<const T>(&value->fValue, 1);
+    throw std::runtime_error("TrackTreeReader::View::Get() :: Wrong type for " + (*fNames)[_i]);
+}
+
+template <typename Task>
+void TrackTreeReader::ForEach(Task _task, Long64_t _begin, Long64_t _end)
+{
+    if (_end < 0 || _end > GetEntries())
+        _end = GetEntries();
+    for (Long64_t entry = _begin; entry < _end; ++entry)
+        _task(Read(entry));
+}
+
+template <typename Task>
+void TrackTreeReader::ParallelForEach(Task _task, int _nThreads, Long64_t _begin, Long64_t _end)
+{
+    if (_end < 0 || _end > GetEntries())
+        _end = GetEntries();
+
+    WorkStealingPool pool(_nThreads);
+    const int nThreads = pool.GetNumberOfThreads();
+    // Whole clusters unless asked otherwise
+    Long64_t maxEntries = fEntriesPerTask > 0 ? fEntriesPerTask : _end - _begin;
+    const auto ranges = GetRanges(_begin, _end, maxEntries);
+
+    std::vector<std::unique_ptr<Source>> sources(nThreads);
+    std::vector<std::unique_ptr<View>> views(nThreads);
+    pool.Run(ranges.size(), [&](int _worker, std::size_t _i) {
+        auto &source = sources[_worker];
+        auto &view = views[_worker];
+        if (!source)
+        {
+            source = Open();
+            view.reset(new View(fBranches, *source));
+        }
+        // The cache of this thread prefetches the baskets of this range only
+        source->fTree->SetCacheEntryRange(ranges[_i].first, ranges[_i].second);
+        for (Long64_t entry = ranges[_i].first; entry < ranges[_i].second; ++entry)
+        {
+            Read(*source, entry);
+            view->fEntry = entry;
+            _task(_worker, static_cast<const View &>(*view));
+        }
+    });
+}
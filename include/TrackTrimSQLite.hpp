@@ -1,9 +1,18 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include "Track.hh"
 
 #include "TrackGenerator.hpp"
+#include "MediumVoxelMap.hpp"
+#include "Span.hpp"
+#include "ClusterPlacement.hpp"
+#include "ClusterStream.hpp"
 
 namespace GarfieldSuppl
 {
@@ -14,6 +23,13 @@ namespace GarfieldSuppl
     {
 
     public:
+        /// Track generator (single precision positions with TRACKTRIMSQLITE_SINGLE_PRECISION)
+#ifdef TRACKTRIMSQLITE_SINGLE_PRECISION
+        using Generator = TrackGeneratorCFloat;
+#else
+        using Generator = TrackGeneratorC;
+#endif
+
         /// Constructor
         TrackTrimSQLite();
         /// Destructor
@@ -42,17 +58,113 @@ namespace GarfieldSuppl
             return m_generator->SetEnergyMarginRatio(ratio_to_de);
         };
 
+        /// Seed of the counter-based random streams.
+        /// Track #i of a run is reproducible from (seed, i) alone.
+        void SetSeed(const std::uint64_t seed) { m_generator->SetSeed(seed); }
+        std::uint64_t GetSeed() const { return m_generator->GetSeed(); }
+
+        /// Index of the track generated by the next NewTrack call.
+        void SetTrackIndex(const std::uint64_t index) { m_generator->SetTrackIndex(index); }
+        std::uint64_t GetTrackIndex() const { return m_generator->GetTrackIndex(); }
+
         void SetTargetClusterSize(const int n) { m_nsize = n; }
         int GetTargetClusterSize() const { return m_nsize; }
 
         void SetClustersMaximum(const int n) { m_maxclusters = n; }
         int GetClustersMaximum() const { return m_maxclusters; }
 
+        /// Box filled with a single medium (e.g. the gas volume).
+        /// Clusters of steps inside it skip the per-cluster medium queries.
+        /// NewTrack compares the media at the corners and the centre and ignores
+        /// the box if they differ; a solid lying wholly inside it is not detected,
+        /// so the caller guarantees that the box holds a single medium.
+        void SetHomogeneousRegion(const double xmin, const double ymin, const double zmin,
+                                  const double xmax, const double ymax, const double zmax)
+        {
+            m_homogeneousRegion = {xmin, ymin, zmin, xmax, ymax, zmax};
+            m_hasHomogeneousRegion = true;
+        }
+        void UnsetHomogeneousRegion() { m_hasHomogeneousRegion = false; }
+
+        /// Voxelized medium map of the drift area with voxels of about resolution [cm],
+        /// built at the next NewTrack. Cluster checks become array lookups
+        /// except in voxels found to contain a medium boundary.
+        /// Without geometry, solids thinner than the resolution can be missed
+        /// (see MediumVoxelMap) and NewTrack warns once; with the geometry of the
+        /// sensor, voxels overlapping the bounding box of a solid always get the exact query.
+        void EnableMediumMap(const double resolution, const Garfield::Geometry *geometry = nullptr)
+        {
+            m_mediumMapResolution = resolution;
+            m_mediumMapGeometry = geometry;
+            m_mediumMapWarned = false;
+        }
+        void DisableMediumMap()
+        {
+            StopAsyncWorker();
+            m_mediumMapResolution = 0.;
+            m_mediumMapGeometry = nullptr;
+            m_mediumMap.Clear();
+        }
+        /// Build the map again at the next NewTrack. Needed after the media or
+        /// the solids of the sensor changed: only the sensor and geometry pointers,
+        /// the drift area and the resolution are compared.
+        void RebuildMediumMap()
+        {
+            StopAsyncWorker();
+            m_mediumMap.Clear();
+        }
+        const MediumVoxelMap &GetMediumMap() const { return m_mediumMap; }
+
+        /// Generate the clusters of the next tracks on a background thread,
+        /// up to depth tracks ahead. NewTrack then swaps in a finished list
+        /// when its arguments and the settings match those the track was made with,
+        /// otherwise the ring is dropped and the track is generated in place.
+        /// Upcoming tracks use the parameters queued with QueueTrack (in order),
+        /// then those of the last NewTrack call. The clusters are the same as without it.
+        /// The worker does not call the sensor: medium checks use the medium map
+        /// and the remaining ones are made by NewTrack. Call DisableAsync (or
+        /// EnableAsync again) after changing the geometry of the sensor.
+        void EnableAsync(const std::size_t depth = 4);
+        void DisableAsync();
+        bool IsAsyncEnabled() const { return m_asyncDepth > 0; }
+        /// Start of an upcoming NewTrack for the background thread
+        void QueueTrack(const double x0, const double y0, const double z0,
+                        const double t0, const double dx0, const double dy0,
+                        const double dz0);
+
+        /// Publish the clusters of every track to stream while NewTrack generates them
+        /// (nullptr : off). GetCluster still returns them afterwards.
+        /// The stream is not owned and NewTrack waits while it is full.
+        void SetClusterStream(ClusterStream *stream) { m_stream = stream; }
+        ClusterStream *GetClusterStream() const { return m_stream; }
+
+        /// Merge the clusters of each track into the cells of a grid
+        /// (origin (x0, y0, z0), cell size dx, dy, dz [cm]) before they are handed out.
+        /// A merged cluster has the summed electrons and energy, the electron-weighted
+        /// centroid and time, and the ion energy of its first cluster; clusters are in
+        /// the order their cells were first hit. A size <= 0 leaves that axis undivided,
+        /// e.g. dz = 0 for readout pads in x-y. The cluster maximum applies before merging.
+        /// With a cluster stream, the merged clusters are published when the track is complete.
+        void EnableClusterMerging(const double dx, const double dy, const double dz,
+                                  const double x0 = 0., const double y0 = 0., const double z0 = 0.);
+        void DisableClusterMerging() { m_merge = false; }
+        bool IsClusterMergingEnabled() const { return m_merge; }
+        /// Number of clusters of the last track before merging
+        std::size_t GetNumberOfUnmergedClusters() const { return m_unmergedClusters; }
+
         void EnableNonUniformCollision() { m_nonuniform_collision = true; };
         void DisableNonUniformCollision() { m_nonuniform_collision = false; };
         bool IsNonUniformCollisionEnabled() const { return m_nonuniform_collision; };
 
         bool ReadFile(const std::string &file);
+        /// Use a collision library loaded in memory, e.g. CollisionLibrary::Open(file),
+        /// which several instances (and threads) can share instead of each reading the file,
+        /// or CollisionLibrary::OpenShared(file) to share it between the processes of a node.
+        void SetLibrary(std::shared_ptr<const CollisionLibrary> library)
+        {
+            StopAsyncWorker();
+            m_generator->SetLibrary(std::move(library));
+        }
 
         virtual bool NewTrack(const double x0, const double y0, const double z0,
                               const double t0, const double dx0, const double dy0,
@@ -60,6 +172,19 @@ namespace GarfieldSuppl
         virtual bool GetCluster(double &xcls, double &ycls, double &zcls,
                                 double &tcls, int &n, double &e, double &extra);
 
+        /// Clusters of the last track as parallel arrays
+        struct cluster_spans
+        {
+            Span<const double> x, y, z, t; ///< Cluster location and time
+            Span<const double> ec;         ///< Energy spent to make the cluster
+            Span<const double> kinetic;    ///< Ion energy when cluster was created
+            Span<const int> electrons;     ///< Number of electrons in this cluster
+            std::size_t size() const { return x.size(); }
+        };
+        /// All clusters of the last track at once (valid until the next NewTrack).
+        /// Independent of the GetCluster position.
+        cluster_spans GetClusters() const;
+
     protected:
         /// Work function [eV]
         double m_work = -1.;
@@ -83,15 +208,222 @@ namespace GarfieldSuppl
             double kinetic;    // Ion energy when cluster was created
             int electrons;     // Number of electrons in this cluster
         };
-        std::vector<cluster> m_clusters;
 
-        std::unique_ptr<TrackGeneratorC> m_generator;
+        /// Clusters of the current track (structure of arrays).
+        /// Capacity is kept between tracks.
+        struct cluster_arrays
+        {
+            std::vector<double> x, y, z, t, ec, kinetic;
+            std::vector<int> electrons;
+
+            std::size_t size() const { return x.size(); }
+            void clear();
+            void reserve(const std::size_t n);
+            void push_back(const cluster &c);
+        };
+        cluster_arrays m_clusters;
+
+        std::unique_ptr<Generator> m_generator;
+        /// Number of collisions generated at a time in NewTrack
+        static constexpr std::size_t m_collisionBlock = 32;
+
+        /// Substream for cluster placement, independent of the generator's
+        static constexpr std::uint32_t m_clusterSubstream = 1;
+        Mm::CounterRandom m_rng;
+        /// Cluster positions along the current step (scratch reused between steps)
+        ClusterPlacement m_placement;
+
+        /// Axis-aligned box
+        struct box
+        {
+            double xmin, ymin, zmin, xmax, ymax, zmax;
+
+            bool Contains(const double x, const double y, const double z) const
+            {
+                return xmin <= x && x <= xmax &&
+                       ymin <= y && y <= ymax &&
+                       zmin <= z && z <= zmax;
+            }
+
+            /// Segment (x, y, z) + t (dx, dy, dz), 0 <= t <= 1, entirely inside
+            bool ContainsSegment(const double x, const double y, const double z,
+                                 const double dx, const double dy, const double dz) const
+            {
+                return Contains(x, y, z) && Contains(x + dx, y + dy, z + dz);
+            }
+
+            /// Segment (x, y, z) + t (dx, dy, dz), 0 <= t <= 1, has a point inside (slab test)
+            bool IntersectsSegment(const double x, const double y, const double z,
+                                   const double dx, const double dy, const double dz) const;
+        };
+
+        /// Where the clusters of a step may be
+        enum class StepRegion
+        {
+            Outside,     ///< no point of the step is in the drift area or the step is in a non-ionisable region
+            Homogeneous, ///< whole step in the homogeneous ionisable region
+            Inside,      ///< whole step in the drift area
+            Crossing     ///< step crosses the boundary of the drift area
+        };
+
+        /// Homogeneous region, whether the media sampled in it agree
+        /// and whether that medium is ionisable (checked once per track)
+        bool m_hasHomogeneousRegion = false;
+        box m_homogeneousRegion;
+        bool m_homogeneousSingleMedium = false;
+        bool m_homogeneousIonisable = false;
+
+        /// Voxel size of the medium map [cm] (no map if 0)
+        double m_mediumMapResolution = 0.;
+        /// Solids marked as boundaries in the medium map (optional)
+        const Garfield::Geometry *m_mediumMapGeometry = nullptr;
+        /// Warning about a map without geometry printed
+        bool m_mediumMapWarned = false;
+        MediumVoxelMap m_mediumMap;
+
+        /// Everything the clusters of a track depend on besides the generator state,
+        /// taken at NewTrack (a copy is handed to the background thread)
+        struct track_settings
+        {
+            double x0, y0, z0, t0, dx0, dy0, dz0; ///< NewTrack arguments
+            double ekin;
+            double work;
+            int nsize;
+            int maxclusters;
+            bool nonuniform;
+            box area; ///< drift area
+            bool hasHomogeneousRegion;
+            box homogeneousRegion;
+            bool homogeneousIonisable;
+            double mediumMapResolution;
+            std::uint64_t seed;
+            double transferProbability;
+            double energyMarginRatio;
+            bool debug;
+
+            bool operator==(const track_settings &o) const;
+        };
+        track_settings MakeSettings(const double x0, const double y0, const double z0,
+                                    const double t0, const double dx0, const double dy0,
+                                    const double dz0) const;
+
+        /// Classify the segment from a collision to the next one
+        static StepRegion ClassifyStep(const track_settings &s,
+                                       const double x, const double y, const double z,
+                                       const double dx, const double dy, const double dz);
+
+        /// Result of the medium test of a cluster
+        enum class ClusterTest
+        {
+            Rejected,
+            Accepted,
+            Pending ///< needs the sensor, left to NewTrack
+        };
+
+        /// Cluster left to NewTrack. The clusters after it up to stepEnd (exclusive)
+        /// belong to the same step, whose ion energy decreases per accepted cluster.
+        struct pending_cluster
+        {
+            std::uint32_t index;
+            std::uint32_t stepEnd;
+        };
+
+        /// Clusters of one track, from the start of the generator to the last cluster.
+        /// test(region, x, y, z) decides on every cluster; pending clusters are kept
+        /// as if accepted and listed in pending. publish(index, cluster) is called
+        /// for every accepted one. Returns false if the cluster limit was reached.
+        template <typename Test, typename Publish>
+        bool GenerateClusters(const track_settings &s, Generator &generator,
+                              Mm::CounterRandom &rng, ClusterPlacement &placement,
+                              cluster_arrays &clusters, std::vector<pending_cluster> &pending,
+                              Test test, Publish publish) const;
+
+        /// Stream of the clusters (not owned)
+        ClusterStream *m_stream = nullptr;
+        void PublishCluster(const std::uint64_t track, const std::size_t index, const cluster &c);
+        /// Publish all clusters of the current track
+        void PublishClusters(const std::uint64_t track);
+
+        /// Grid of the cluster merging
+        bool m_merge = false;
+        double m_mergeOrigin[3] = {0., 0., 0.};
+        double m_mergeCell[3] = {0., 0., 0.};
+        std::size_t m_unmergedClusters = 0;
+
+        struct voxel_key
+        {
+            std::int64_t ix, iy, iz;
+            bool operator==(const voxel_key &o) const { return ix == o.ix && iy == o.iy && iz == o.iz; }
+        };
+        struct voxel_key_hash
+        {
+            std::size_t operator()(const voxel_key &k) const
+            {
+                std::uint64_t h = std::uint64_t(k.ix) * 0x9E3779B97F4A7C15ull;
+                h ^= std::uint64_t(k.iy) * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+                h ^= std::uint64_t(k.iz) * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+                return h;
+            }
+        };
+        /// Scratch of MergeClusters (capacity kept between tracks)
+        std::unordered_map<voxel_key, std::uint32_t, voxel_key_hash> m_mergeIndex;
+        cluster_arrays m_merged;
+        std::vector<double> m_mergeWeight;
+        /// Replace the clusters of the current track by their merge on the grid
+        void MergeClusters();
+
+        /// Track made by the background thread
+        struct async_track
+        {
+            track_settings settings;
+            bool queued;                     ///< parameters came from QueueTrack
+            std::uint64_t index, nextIndex;  ///< generator track index before and after
+            cluster_arrays clusters;
+            std::vector<pending_cluster> pending;
+            bool complete;                   ///< cluster limit not reached
+        };
+
+        /// Tracks generated ahead (0 : off)
+        std::size_t m_asyncDepth = 0;
+        std::thread m_asyncThread;
+        std::mutex m_asyncMutex;
+        std::condition_variable m_asyncCondition;
+        bool m_asyncStop = false;
+        /// Finished tracks, oldest first
+        std::deque<async_track> m_asyncRing;
+        /// Parameters of upcoming tracks from QueueTrack
+        std::deque<track_settings> m_asyncQueue;
+        /// Cluster arrays handed back for reuse
+        std::vector<cluster_arrays> m_asyncSpare;
+
+        /// Swap in the next track of the ring if it was made with s
+        bool TakeAsyncTrack(const track_settings &s);
+        /// Background thread continuing after s with track index m_generator->GetTrackIndex()
+        void StartAsyncWorker(const track_settings &s);
+        /// Stop the background thread and drop its tracks (queued parameters are kept)
+        void StopAsyncWorker();
+        void RunAsyncWorker(track_settings s, std::unique_ptr<Generator> generator);
 
-        bool NewClusterPushable() const
+        /// Cluster test with the result of ClassifyStep
+        bool IsInside(const StepRegion region, const double x, const double y, const double z)
         {
-            return m_maxclusters < 0 || m_clusters.size() < m_maxclusters;
+            switch (region)
+            {
+            case StepRegion::Outside:
+                return false;
+            case StepRegion::Homogeneous:
+                return true;
+            case StepRegion::Inside:
+                return IsInIonisableMedium(x, y, z);
+            default:
+                return IsInside(x, y, z);
+            }
         }
 
         bool IsInside(const double x, const double y, const double z);
+        bool IsInIonisableMedium(const double x, const double y, const double z);
+        /// Same medium at the corners and the centre of the homogeneous region
+        /// (sets m_homogeneousIonisable)
+        bool CheckHomogeneousRegion();
     };
 }
\ No newline at end of file
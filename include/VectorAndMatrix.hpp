@@ -1,24 +1,36 @@
 #pragma once
 
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
 namespace Mm
 {
+    // Scalar type of a vector type T with X(), Y() and Z()
+    template <typename T>
+    using ScalarOf = typename std::decay<decltype(std::declval<const T &>().X())>::type;
+
     template <typename T>
     struct Matrix
     {
+        using Scalar = ScalarOf<T>;
+
         Matrix()
             : fXX(1), fXY(0), fXZ(0),
               fYX(0), fYY(1), fYZ(0),
               fZX(0), fZY(0), fZZ(1){};
 
-        double fXX, fXY, fXZ;
-        double fYX, fYY, fYZ;
-        double fZX, fZY, fZZ;
+        Scalar fXX, fXY, fXZ;
+        Scalar fYX, fYY, fYZ;
+        Scalar fZX, fZY, fZZ;
 
         T Apply(const T &_in)
         {
-            double x = fXX * _in.X() + fXY * _in.Y() + fXZ * _in.Z();
-            double y = fYX * _in.X() + fYY * _in.Y() + fYZ * _in.Z();
-            double z = fZX * _in.X() + fZY * _in.Y() + fZZ * _in.Z();
+            Scalar x = fXX * _in.X() + fXY * _in.Y() + fXZ * _in.Z();
+            Scalar y = fYX * _in.X() + fYY * _in.Y() + fYZ * _in.Z();
+            Scalar z = fZX * _in.X() + fZY * _in.Y() + fZZ * _in.Z();
             return T(x, y, z);
         }
 
@@ -54,14 +66,14 @@ namespace Mm
             fZX = fZY = 0;
         }
 
-        double Determinant() const
+        Scalar Determinant() const
         {
-            double pos = fXX * fYY * fZZ + fYX * fZY * fXZ + fZX * fXY * fYZ;
-            double neg = fXZ * fYY * fZX + fYZ * fZY * fXX + fZZ * fXY * fYX;
+            Scalar pos = fXX * fYY * fZZ + fYX * fZY * fXZ + fZX * fXY * fYZ;
+            Scalar neg = fXZ * fYY * fZX + fYZ * fZY * fXX + fZZ * fXY * fYX;
             return pos - neg;
         }
 
-        void Scale(double _sca)
+        void Scale(Scalar _sca)
         {
             fXX = _sca * fXX;
             fXY = _sca * fXY;
@@ -84,10 +96,38 @@ namespace Mm
                 Scale(1 / std::cbrt(det));
             }
         }
+
+        // Re-project to a rotation by Gram-Schmidt on the rows
+        // (a nearby rotation, not the closest one in the Frobenius norm).
+        // Removes the drift accumulated by long products of rotations.
+        void Orthonormalize()
+        {
+            Scalar n0 = std::sqrt(fXX * fXX + fXY * fXY + fXZ * fXZ);
+            if (n0 == 0)
+                return;
+            fXX /= n0;
+            fXY /= n0;
+            fXZ /= n0;
+
+            Scalar d01 = fXX * fYX + fXY * fYY + fXZ * fYZ;
+            fYX -= d01 * fXX;
+            fYY -= d01 * fXY;
+            fYZ -= d01 * fXZ;
+            Scalar n1 = std::sqrt(fYX * fYX + fYY * fYY + fYZ * fYZ);
+            if (n1 == 0)
+                return;
+            fYX /= n1;
+            fYY /= n1;
+            fYZ /= n1;
+
+            fZX = fXY * fYZ - fXZ * fYY;
+            fZY = fXZ * fYX - fXX * fYZ;
+            fZZ = fXX * fYY - fXY * fYX;
+        }
     };
 
     template <typename T>
-    T Scale(double _sc, const T &_vec)
+    T Scale(ScalarOf<T> _sc, const T &_vec)
     {
         return T(_sc * _vec.X(), _sc * _vec.Y(), _sc * _vec.Z());
     }
@@ -99,33 +139,33 @@ namespace Mm
     }
 
     template <typename T>
-    double DotProduct(const T &_l, const T &_r)
+    ScalarOf<T> DotProduct(const T &_l, const T &_r)
     {
         return _l.X() * _r.X() + _l.Y() * _r.Y() + _l.Z() * _r.Z();
     }
 
     template <typename T>
-    double Norm(const T &_v)
+    ScalarOf<T> Norm(const T &_v)
     {
         return std::sqrt(DotProduct(_v, _v));
     }
 
     template <typename T>
-    double Angle(const T &_l, const T &_r)
+    ScalarOf<T> Angle(const T &_l, const T &_r)
     {
         auto cross = DotProduct(_l, _r);
-        double normalization = Norm(_l) * Norm(_r);
+        ScalarOf<T> normalization = Norm(_l) * Norm(_r);
         if (normalization == 0)
             throw std::runtime_error("Angle(): zero division.");
         //cos (theta)
-        double cs = cross / normalization;
+        ScalarOf<T> cs = cross / normalization;
         return std::acos(cs);
     }
 
     template <typename T>
     bool Normalize(T &_v)
     {
-        double norm = Norm(_v);
+        ScalarOf<T> norm = Norm(_v);
         if (norm == 0)
             return false;
         _v = T(_v.X() / norm, _v.Y() / norm, _v.Z() / norm);
@@ -135,9 +175,9 @@ namespace Mm
     template <typename T>
     T CrossProduct(const T &_l, const T &_r)
     {
-        double x = _l.Y() * _r.Z() - _l.Z() * _r.Y();
-        double y = _l.Z() * _r.X() - _l.X() * _r.Z();
-        double z = _l.X() * _r.Y() - _l.Y() * _r.X();
+        ScalarOf<T> x = _l.Y() * _r.Z() - _l.Z() * _r.Y();
+        ScalarOf<T> y = _l.Z() * _r.X() - _l.X() * _r.Z();
+        ScalarOf<T> z = _l.X() * _r.Y() - _l.Y() * _r.X();
 
         return T(x, y, z);
     }
@@ -147,63 +187,135 @@ namespace Mm
     {
         Matrix<T> ret;
 
-        ret.fXX = DotProduct(_l.Row(0), _r.Column(0));
-        ret.fXY = DotProduct(_l.Row(0), _r.Column(1));
-        ret.fXZ = DotProduct(_l.Row(0), _r.Column(2));
+        ret.fXX = _l.fXX * _r.fXX + _l.fXY * _r.fYX + _l.fXZ * _r.fZX;
+        ret.fXY = _l.fXX * _r.fXY + _l.fXY * _r.fYY + _l.fXZ * _r.fZY;
+        ret.fXZ = _l.fXX * _r.fXZ + _l.fXY * _r.fYZ + _l.fXZ * _r.fZZ;
 
-        ret.fYX = DotProduct(_l.Row(1), _r.Column(0));
-        ret.fYY = DotProduct(_l.Row(1), _r.Column(1));
-        ret.fYZ = DotProduct(_l.Row(1), _r.Column(2));
+        ret.fYX = _l.fYX * _r.fXX + _l.fYY * _r.fYX + _l.fYZ * _r.fZX;
+        ret.fYY = _l.fYX * _r.fXY + _l.fYY * _r.fYY + _l.fYZ * _r.fZY;
+        ret.fYZ = _l.fYX * _r.fXZ + _l.fYY * _r.fYZ + _l.fYZ * _r.fZZ;
 
-        ret.fZX = DotProduct(_l.Row(2), _r.Column(0));
-        ret.fZY = DotProduct(_l.Row(2), _r.Column(1));
-        ret.fZZ = DotProduct(_l.Row(2), _r.Column(2));
+        ret.fZX = _l.fZX * _r.fXX + _l.fZY * _r.fYX + _l.fZZ * _r.fZX;
+        ret.fZY = _l.fZX * _r.fXY + _l.fZY * _r.fYY + _l.fZZ * _r.fZY;
+        ret.fZZ = _l.fZX * _r.fXZ + _l.fZY * _r.fYZ + _l.fZZ * _r.fZZ;
 
         return ret;
     }
 
+    // Rotation about unit vector _axis by the angle with cosine _cs and sine _sn
     template <typename T>
-    Matrix<T> MakeRotaionMatrix(const T &_axis, double _degree)
+    Matrix<T> MakeRotaionMatrixUnitAxis(const T &_axis, ScalarOf<T> _cs, ScalarOf<T> _sn)
     {
-
-        double norm = Norm(_axis);
         Matrix<T> mat;
-        if (norm == 0)
-        {
-            throw std::runtime_error("MakeRotationMatrix() : Zero vector input !");
-        }
 
-        double nx = _axis.X() / norm;
-        double ny = _axis.Y() / norm;
-        double nz = _axis.Z() / norm;
-        double sn = sin(_degree);
-        double cs = cos(_degree);
+        ScalarOf<T> nx = _axis.X();
+        ScalarOf<T> ny = _axis.Y();
+        ScalarOf<T> nz = _axis.Z();
+        ScalarOf<T> vs = 1 - _cs;
 
-        mat.fXX = nx * nx * (1 - cs) + cs;
-        mat.fXY = nx * ny * (1 - cs) - nz * sn;
-        mat.fXZ = nz * nx * (1 - cs) + ny * sn;
+        mat.fXX = nx * nx * vs + _cs;
+        mat.fXY = nx * ny * vs - nz * _sn;
+        mat.fXZ = nz * nx * vs + ny * _sn;
 
-        mat.fYX = nx * ny * (1 - cs) + nz * sn;
-        mat.fYY = ny * ny * (1 - cs) + cs;
-        mat.fYZ = ny * nz * (1 - cs) - nx * sn;
+        mat.fYX = nx * ny * vs + nz * _sn;
+        mat.fYY = ny * ny * vs + _cs;
+        mat.fYZ = ny * nz * vs - nx * _sn;
 
-        mat.fZX = nz * nx * (1 - cs) - ny * sn;
-        mat.fZY = ny * nz * (1 - cs) + nx * sn;
-        mat.fZZ = nz * nz * (1 - cs) + cs;
+        mat.fZX = nz * nx * vs - ny * _sn;
+        mat.fZY = ny * nz * vs + nx * _sn;
+        mat.fZZ = nz * nz * vs + _cs;
 
         return mat;
     };
 
+    template <typename T>
+    Matrix<T> MakeRotaionMatrix(const T &_axis, double _degree)
+    {
+        ScalarOf<T> norm = Norm(_axis);
+        if (norm == 0)
+        {
+            throw std::runtime_error("MakeRotationMatrix() : Zero vector input !");
+        }
+
+        return MakeRotaionMatrixUnitAxis(Scale(1 / norm, _axis),
+                                         std::cos(_degree), std::sin(_degree));
+    };
+
+    // Rotate _vec about unit vector _axis (Rodrigues formula)
+    template <typename T>
+    T RotateUnitAxis(const T &_axis, ScalarOf<T> _cs, ScalarOf<T> _sn, const T &_vec)
+    {
+        ScalarOf<T> dp = DotProduct(_axis, _vec) * (1 - _cs);
+        auto cross = CrossProduct(_axis, _vec);
+        return T(_vec.X() * _cs + cross.X() * _sn + _axis.X() * dp,
+                 _vec.Y() * _cs + cross.Y() * _sn + _axis.Y() * dp,
+                 _vec.Z() * _cs + cross.Z() * _sn + _axis.Z() * dp);
+    };
+
     //Make rotation matrix which transform _dir1 to _dir2
+    // R = c I + [v]x + v v^T / (1 + c) with v = dir1 x dir2, c = dir1 . dir2
+    // (no trigonometric function)
     template <typename T>
     Matrix<T> MakeRotaionMatrix(const T &_dir1, const T &_dir2)
     {
         T dir1 = _dir1;
-        Normalize(dir1);
         T dir2 = _dir2;
-        Normalize(dir2);
-        auto axis = CrossProduct(dir1, dir2);
-        Normalize(axis);
-        return MakeRotaionMatrix(axis, Angle(dir1, dir2));
+        if (!Normalize(dir1) || !Normalize(dir2))
+        {
+            throw std::runtime_error("MakeRotationMatrix() : Zero vector input !");
+        }
+
+        auto v = CrossProduct(dir1, dir2);
+        ScalarOf<T> c = DotProduct(dir1, dir2);
+        Matrix<T> mat;
+
+        // 1 + c = |dir1 + dir2|^2 / 2 without cancellation toward anti-parallel input
+        // (matters in single precision)
+        auto sum = Add(dir1, dir2);
+        ScalarOf<T> opc = DotProduct(sum, sum) / 2;
+
+        // Anti-parallel : rotate by pi about any axis perpendicular to dir1
+        if (opc < 16 * std::numeric_limits<ScalarOf<T>>::epsilon() * std::numeric_limits<ScalarOf<T>>::epsilon())
+        {
+            ScalarOf<T> ax = std::abs(dir1.X());
+            ScalarOf<T> ay = std::abs(dir1.Y());
+            ScalarOf<T> az = std::abs(dir1.Z());
+            T e = (ax <= ay && ax <= az) ? T(1, 0, 0) : (ay <= az ? T(0, 1, 0) : T(0, 0, 1));
+            auto u = CrossProduct(dir1, e);
+            Normalize(u);
+            return MakeRotaionMatrixUnitAxis(u, -1, 0);
+        }
+
+        ScalarOf<T> h = 1 / opc;
+
+        mat.fXX = c + h * v.X() * v.X();
+        mat.fXY = h * v.X() * v.Y() - v.Z();
+        mat.fXZ = h * v.X() * v.Z() + v.Y();
+
+        mat.fYX = h * v.Y() * v.X() + v.Z();
+        mat.fYY = c + h * v.Y() * v.Y();
+        mat.fYZ = h * v.Y() * v.Z() - v.X();
+
+        mat.fZX = h * v.Z() * v.X() - v.Y();
+        mat.fZY = h * v.Z() * v.Y() + v.X();
+        mat.fZZ = c + h * v.Z() * v.Z();
+
+        return mat;
+    };
+
+    // Uniform point (cos, sin) on the unit circle without trigonometric function
+    // (rejection sampling on the unit disk, 4/pi draws of pairs on average)
+    template <typename R, typename S>
+    void RandomUnitCircle(R &_random, S &_cs, S &_sn)
+    {
+        S u, v, s;
+        do
+        {
+            u = 2 * _random() - 1;
+            v = 2 * _random() - 1;
+            s = u * u + v * v;
+        } while (s >= 1 || s == 0);
+        _cs = (u * u - v * v) / s;
+        _sn = 2 * u * v / s;
     };
 }
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Parallel loop over [0, n) with per-thread ranges and work stealing.
+// Each worker starts with a contiguous share of the index range and takes
+// items from its front; an idle worker steals the back half of the busiest
+// remaining range, so uneven item costs do not leave threads idle.
+class WorkStealingPool
+{
+public:
+    // _nThreads <= 0 -> std::thread::hardware_concurrency()
+    WorkStealingPool(int _nThreads = 0);
+
+    int GetNumberOfThreads() const { return fNumberOfThreads; };
+
+    // Call _task(worker, i) for every i in [0, _n) and wait for completion.
+    // worker is in [0, GetNumberOfThreads()) and identifies per-thread state.
+    // The first exception thrown by a task is rethrown after all threads joined.
+    void Run(std::size_t _n,
+             const std::function<void(int, std::size_t)> &_task);
+
+private:
+    int fNumberOfThreads;
+};
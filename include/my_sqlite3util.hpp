@@ -8,7 +8,9 @@
 #include <sqlite3.h>
 
 std::string my_sqlite3_column_string(sqlite3_stmt * _query, int i){
-    std::ostringstream tmp;
-    tmp << sqlite3_column_text(_query, i);
-    return tmp.str();
+    // Text and length straight from SQLite (no stream per column)
+    const unsigned char *text = sqlite3_column_text(_query, i);
+    if (!text)
+        return std::string();
+    return std::string(reinterpret_cast<const char *>(text), sqlite3_column_bytes(_query, i));
 }
@@ -7,12 +7,22 @@ int main(int argc, char *argv[])
 
     if (argc < 3)
     {
-        std::cerr << argv[0] << " [input_directory] [output_name]" << std::endl;
+        std::cerr << argv[0] << " [input_directory] ([input_directory] ...) [output_name]" << std::endl;
+        std::cerr << "   Tracks are appended to an existing library," << std::endl;
+        std::cerr << "   so one library can hold TRIM runs at several incident energies." << std::endl;
         return 1;
     }
     TRIM2SQLite t2s;
     // Example
     // t2s.MakeSQLiteFile("../input/TRIM/1000/3H/10", "hoge.sqlite");
-    t2s.MakeSQLiteFile(argv[1], argv[2]);
+    const std::string output = argv[argc - 1];
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (!t2s.MakeSQLiteFile(argv[i], output))
+        {
+            std::cerr << "Failed to read " << argv[i] << std::endl;
+            return 1;
+        }
+    }
     return 0;
-}
\ No newline at end of file
+}
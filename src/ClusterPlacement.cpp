@@ -0,0 +1,73 @@
+#include "ClusterPlacement.hpp"
+
+#include <cmath>
+
+void ClusterPlacement::SortedRandom(Mm::CounterRandom &_random, std::size_t _n)
+{
+    if (_n <= SortThreshold)
+    {
+        // Few clusters: sorting is cheaper than the logarithms
+        fT.resize(_n);
+        double *t = fT.data();
+        _random.Uniform(t, _n);
+        for (std::size_t i = 1; i < _n; ++i)
+        {
+            const double u = t[i];
+            std::size_t j = i;
+            for (; j > 0 && t[j - 1] > u; --j)
+                t[j] = t[j - 1];
+            t[j] = u;
+        }
+        return;
+    }
+
+    // n + 1 spacings, the last one only enters the normalization
+    fT.resize(_n + 1);
+    double *t = fT.data();
+    _random.Uniform(t, _n + 1);
+
+    for (std::size_t i = 0; i <= _n; ++i)
+        t[i] = -std::log1p(-t[i]); // -log(1 - U), finite for U in [0, 1)
+
+    double sum = 0;
+    for (std::size_t i = 0; i <= _n; ++i)
+    {
+        sum += t[i];
+        t[i] = sum;
+    }
+
+    const double norm = sum > 0 ? 1 / sum : 0;
+    for (std::size_t i = 0; i < _n; ++i)
+        t[i] *= norm;
+
+    fT.resize(_n);
+}
+
+void ClusterPlacement::Even(std::size_t _n)
+{
+    fT.resize(_n);
+    double *t = fT.data();
+    const double nDiv = _n + 1;
+    for (std::size_t i = 0; i < _n; ++i)
+        t[i] = (i + 1) / nDiv;
+}
+
+void ClusterPlacement::Place(double _x, double _y, double _z,
+                             double _dx, double _dy, double _dz)
+{
+    const std::size_t n = fT.size();
+    fX.resize(n);
+    fY.resize(n);
+    fZ.resize(n);
+
+    const double *t = fT.data();
+    double *x = fX.data();
+    double *y = fY.data();
+    double *z = fZ.data();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = _x + _dx * t[i];
+        y[i] = _y + _dy * t[i];
+        z[i] = _z + _dz * t[i];
+    }
+}
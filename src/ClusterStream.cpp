@@ -0,0 +1,83 @@
+#include "ClusterStream.hpp"
+
+#include <thread>
+
+ClusterStream::ClusterStream(std::size_t _capacity) : fSlots(), fMask(0), fHead(0), fTail(0), fClosed(false)
+{
+    std::size_t capacity = 2;
+    while (capacity < _capacity)
+        capacity <<= 1;
+    fMask = capacity - 1;
+
+    fSlots.reset(new Slot[capacity]);
+    for (std::size_t i = 0; i < capacity; ++i)
+        fSlots[i].fSequence.store(i, std::memory_order_relaxed);
+}
+
+bool ClusterStream::TryPush(const Cluster &_cluster)
+{
+    const std::size_t pos = fTail;
+    Slot &slot = fSlots[pos & fMask];
+    // Free once the consumer of pos - capacity released it
+    if (slot.fSequence.load(std::memory_order_acquire) != pos)
+        return false;
+    slot.fCluster = _cluster;
+    slot.fSequence.store(pos + 1, std::memory_order_release);
+    fTail = pos + 1;
+    return true;
+}
+
+void ClusterStream::Push(const Cluster &_cluster)
+{
+    while (!TryPush(_cluster))
+        std::this_thread::yield();
+}
+
+void ClusterStream::Close()
+{
+    fClosed.store(true, std::memory_order_release);
+}
+
+bool ClusterStream::TryPop(Cluster &_cluster)
+{
+    std::size_t pos = fHead.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Slot &slot = fSlots[pos & fMask];
+        const std::size_t seq = slot.fSequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+        if (diff == 0)
+        {
+            // Filled: claim it (pos is reloaded on failure)
+            if (fHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                _cluster = slot.fCluster;
+                slot.fSequence.store(pos + fMask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // Not filled yet: empty
+            return false;
+        }
+        else
+        {
+            // Claimed by another consumer
+            pos = fHead.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool ClusterStream::Pop(Cluster &_cluster)
+{
+    for (;;)
+    {
+        if (TryPop(_cluster))
+            return true;
+        if (IsClosed())
+            // Clusters pushed before Close are visible now
+            return TryPop(_cluster);
+        std::this_thread::yield();
+    }
+}
@@ -1,6 +1,9 @@
 #include "CollisionDBHandler.hpp"
 #include "my_sqlite3util.hpp"
 
+#include <memory>
+#include <stdexcept>
+
 int CollisionDBHandler::GetNumberOfTracks(int _trackID)
 {
 
@@ -76,6 +79,44 @@ CollisionDBHandler::GetCollisions(const std::string &_constraint,
     return ret;
 }
 
+bool CollisionDBHandler::HasCatalog()
+{
+    std::string sQuery = "SELECT COUNT(*) FROM sqlite_master ";
+    sQuery += "WHERE type = 'table' AND name = '" + TRIM2SQLite::NameOfCatalog + "';";
+    return ExecuteCountQuery(sQuery) > 0;
+}
+
+std::vector<CatalogRecord> CollisionDBHandler::GetCatalog()
+{
+    std::string sQuery;
+    if (HasCatalog())
+        sQuery = "SELECT track_id, e0 FROM " + TRIM2SQLite::NameOfCatalog + " ORDER BY e0, track_id;";
+    else
+        sQuery = "SELECT track_id, e_inc FROM collisions WHERE collision_id = 0 ORDER BY e_inc, track_id;";
+
+    sqlite3_stmt *query;
+    auto err = sqlite3_prepare_v2(fpDB,
+                                  sQuery.c_str(),
+                                  -1, &query, nullptr);
+    if (err != SQLITE_OK)
+    {
+        sqlite3_finalize(query);
+        throw std::runtime_error("CollisionDBHandler::GetCatalog() : Query preparation error.");
+    }
+
+    std::vector<CatalogRecord> ret;
+    while (sqlite3_step(query) == SQLITE_ROW)
+    {
+        CatalogRecord rec;
+        rec.fTrackID = sqlite3_column_int(query, 0);
+        rec.fEnergy = sqlite3_column_double(query, 1);
+        ret.push_back(rec);
+    }
+    sqlite3_finalize(query);
+
+    return ret;
+}
+
 int CollisionDBHandler::ExecuteCountQuery(const std::string &_query)
 {
     sqlite3_stmt *query;
@@ -134,43 +175,7 @@ int CollisionDBHandler::ExecuteSelectQuery(const std::string &_query,
     while (err == SQLITE_ROW)
     {
         _rec.push_back(TRIM2SQLite::CollisionRecord());
-
-        int track_id = sqlite3_column_int(query, 0);
-        int collision_id = sqlite3_column_int(query, 1);
-
-        double e_inc = sqlite3_column_double(query, 2);
-        std::string incident_ion = my_sqlite3_column_string(query, 3);
-        int incident_ion_mass = sqlite3_column_int(query, 4);
-        std::string recoil_ion = my_sqlite3_column_string(query, 5);
-        double e_rec = sqlite3_column_double(query, 6);
-
-        double x = sqlite3_column_double(query, 7);
-        double y = sqlite3_column_double(query, 8);
-        double z = sqlite3_column_double(query, 9);
-
-        double dx0 = sqlite3_column_double(query, 10);
-        double dy0 = sqlite3_column_double(query, 11);
-        double dz0 = sqlite3_column_double(query, 12);
-
-        double dx1 = sqlite3_column_double(query, 13);
-        double dy1 = sqlite3_column_double(query, 14);
-        double dz1 = sqlite3_column_double(query, 15);
-
-        double dr = sqlite3_column_double(query, 16);
-        double de = sqlite3_column_double(query, 17);
-
-        _rec.back().SetTrackID(track_id);
-        _rec.back().SetCollisionID(collision_id);
-        _rec.back().SetIncidentEnergy(e_inc);
-        _rec.back().SetIncidentIon(incident_ion);
-        _rec.back().SetMassNumber(incident_ion_mass);
-        _rec.back().SetRecoilIon(recoil_ion);
-        _rec.back().SetRecoilEnergy(e_rec);
-        _rec.back().SetPosition(x, y, z);
-        _rec.back().SetIncidentDirection(dx0, dy0, dz0);
-        _rec.back().SetScatteringDirection(dx1, dy1, dz1);
-        _rec.back().SetDistanceToNextCollision(dr);
-        _rec.back().SetEnergyLoss(de);
+        ReadRow(query, _rec.back());
 
         err = sqlite3_step(query);
     }
@@ -178,4 +183,90 @@ int CollisionDBHandler::ExecuteSelectQuery(const std::string &_query,
     sqlite3_finalize(query);
 
     return _rec.size();
-}
\ No newline at end of file
+}
+
+void CollisionDBHandler::ReadAllCollisions(const std::function<void(const TRIM2SQLite::CollisionRecord &)> &_callback)
+{
+    ReadCollisions("CollisionDBHandler::ReadAllCollisions()",
+                   "SELECT * FROM collisions ORDER BY track_id, collision_id;",
+                   {}, _callback);
+}
+
+void CollisionDBHandler::ReadCollisions(int _trackIDMin, int _trackIDMax,
+                                        const std::function<void(const TRIM2SQLite::CollisionRecord &)> &_callback)
+{
+    ReadCollisions("CollisionDBHandler::ReadCollisions()",
+                   "SELECT * FROM collisions WHERE track_id BETWEEN ? AND ? ORDER BY track_id, collision_id;",
+                   {_trackIDMin, _trackIDMax}, _callback);
+}
+
+void CollisionDBHandler::ReadCollisions(const std::string &_caller, const std::string &_query,
+                                        const std::vector<int> &_parameters,
+                                        const std::function<void(const TRIM2SQLite::CollisionRecord &)> &_callback)
+{
+    sqlite3_stmt *stmt = nullptr;
+    auto err = sqlite3_prepare_v2(fpDB,
+                                  _query.c_str(),
+                                  -1, &stmt, nullptr);
+    // Finalized also when the callback throws
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> query(stmt, sqlite3_finalize);
+    if (err != SQLITE_OK)
+        throw std::runtime_error(_caller + " : Query preparation error.");
+
+    for (std::size_t i = 0; i < _parameters.size(); ++i)
+    {
+        if (sqlite3_bind_int(query.get(), i + 1, _parameters[i]) != SQLITE_OK)
+            throw std::runtime_error(_caller + " : Parameter binding error.");
+    }
+
+    TRIM2SQLite::CollisionRecord rec;
+    while ((err = sqlite3_step(query.get())) == SQLITE_ROW)
+    {
+        ReadRow(query.get(), rec);
+        _callback(rec);
+    }
+    // A failed step (I/O error, corrupt page ...) must not look like the end of the library
+    if (err != SQLITE_DONE)
+        throw std::runtime_error(_caller + " : " + sqlite3_errmsg(fpDB));
+}
+
+// One row of SELECT * FROM collisions
+void CollisionDBHandler::ReadRow(sqlite3_stmt *_query, TRIM2SQLite::CollisionRecord &_rec)
+{
+    int track_id = sqlite3_column_int(_query, 0);
+    int collision_id = sqlite3_column_int(_query, 1);
+
+    double e_inc = sqlite3_column_double(_query, 2);
+    std::string incident_ion = my_sqlite3_column_string(_query, 3);
+    int incident_ion_mass = sqlite3_column_int(_query, 4);
+    std::string recoil_ion = my_sqlite3_column_string(_query, 5);
+    double e_rec = sqlite3_column_double(_query, 6);
+
+    double x = sqlite3_column_double(_query, 7);
+    double y = sqlite3_column_double(_query, 8);
+    double z = sqlite3_column_double(_query, 9);
+
+    double dx0 = sqlite3_column_double(_query, 10);
+    double dy0 = sqlite3_column_double(_query, 11);
+    double dz0 = sqlite3_column_double(_query, 12);
+
+    double dx1 = sqlite3_column_double(_query, 13);
+    double dy1 = sqlite3_column_double(_query, 14);
+    double dz1 = sqlite3_column_double(_query, 15);
+
+    double dr = sqlite3_column_double(_query, 16);
+    double de = sqlite3_column_double(_query, 17);
+
+    _rec.SetTrackID(track_id);
+    _rec.SetCollisionID(collision_id);
+    _rec.SetIncidentEnergy(e_inc);
+    _rec.SetIncidentIon(incident_ion);
+    _rec.SetMassNumber(incident_ion_mass);
+    _rec.SetRecoilIon(recoil_ion);
+    _rec.SetRecoilEnergy(e_rec);
+    _rec.SetPosition(x, y, z);
+    _rec.SetIncidentDirection(dx0, dy0, dz0);
+    _rec.SetScatteringDirection(dx1, dy1, dz1);
+    _rec.SetDistanceToNextCollision(dr);
+    _rec.SetEnergyLoss(de);
+}
@@ -0,0 +1,525 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CollisionLibrary.hpp"
+
+namespace
+{
+    // Array of the image
+    struct Section
+    {
+        std::uint64_t fOffset; // bytes from the start of the image
+        std::uint64_t fCount;  // elements
+    };
+
+    template <typename T>
+    Span<const T> GetSection(const char *_image, const Section &_section)
+    {
+        return Span<const T>(reinterpret_cast<const T *>(_image + _section.fOffset), _section.fCount);
+    }
+}
+
+// Start of the image. The arrays follow at the offsets of the sections.
+struct CollisionLibrary::Header
+{
+    char fMagic[8];
+    std::uint32_t fFormat;
+    // Set last by the publisher of a shared-memory segment
+    std::uint32_t fReady;
+    std::uint64_t fImageSize;
+    // DB file the image was made from
+    std::uint64_t fSourceSize;
+    std::int64_t fSourceTime;
+
+    Section fRows, fIons;
+    Section fTrackIDs, fTrackBegin;
+    Section fEnergyOut, fEnergyOutRow;
+    Section fEnergies, fEnergyBegin, fEnergyTrackIDs;
+};
+
+namespace
+{
+    const char Magic[8] = {'T', 'T', 'S', 'Q', 'L', 'L', 'I', 'B'};
+
+    // Library per key, kept while someone holds it
+    std::shared_ptr<const CollisionLibrary>
+    GetCached(const std::string &_key,
+              const std::function<std::shared_ptr<const CollisionLibrary>()> &_load)
+    {
+        static std::mutex mutex;
+        static std::map<std::string, std::weak_ptr<const CollisionLibrary>> libraries;
+
+        // Held while loading, so that concurrent callers wait for the same library
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &entry = libraries[_key];
+        auto library = entry.lock();
+        if (!library)
+        {
+            library = _load();
+            entry = library;
+        }
+        return library;
+    }
+
+    bool GetSourceStat(const std::string &_fileName, std::uint64_t &_size, std::int64_t &_time)
+    {
+        struct stat st;
+        if (stat(_fileName.c_str(), &st) != 0)
+            return false;
+        _size = st.st_size;
+        _time = st.st_mtime;
+        return true;
+    }
+
+    std::string ErrorString(const std::string &_where)
+    {
+        return "CollisionLibrary::" + _where + " : " + std::strerror(errno);
+    }
+
+    // Unlink the segment _name only if it is still the one open as _fd :
+    // another process may already have replaced it by a fresh segment.
+    void UnlinkIfSame(const std::string &_name, int _fd)
+    {
+        struct stat mine, current;
+        if (fstat(_fd, &mine) != 0)
+            return;
+        int fd = shm_open(_name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return;
+        const bool same = fstat(fd, &current) == 0 &&
+                          current.st_dev == mine.st_dev && current.st_ino == mine.st_ino;
+        close(fd);
+        if (same)
+            shm_unlink(_name.c_str());
+    }
+}
+
+// Arrays of a library being read from a DB file, written out as an image
+class CollisionLibrary::Builder
+{
+public:
+    Builder(const std::string &_fileName)
+        : fSourceSize(0), fSourceTime(0)
+    {
+        CollisionDBHandler db(_fileName);
+        GetSourceStat(_fileName, fSourceSize, fSourceTime);
+        db.ReadAllCollisions([this](const CollisionRecord &_rec) { Append(_rec); });
+        fTrackBegin.push_back(fRows.size());
+        BuildIndex(db.GetCatalog());
+    };
+
+    std::size_t GetImageSize() const
+    {
+        Header header;
+        return Layout(header);
+    };
+
+    // _image has GetImageSize() bytes, aligned for doubles. fReady is left 0.
+    void Write(char *_image) const
+    {
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        header.fImageSize = Layout(header);
+        std::memcpy(header.fMagic, Magic, sizeof(Magic));
+        header.fFormat = ImageFormat;
+        header.fSourceSize = fSourceSize;
+        header.fSourceTime = fSourceTime;
+        std::memcpy(_image, &header, sizeof(header));
+
+        Copy(_image, header.fRows, fRows);
+        Copy(_image, header.fIons, fIons);
+        Copy(_image, header.fTrackIDs, fTrackIDs);
+        Copy(_image, header.fTrackBegin, fTrackBegin);
+        Copy(_image, header.fEnergyOut, fEnergyOut);
+        Copy(_image, header.fEnergyOutRow, fEnergyOutRow);
+        Copy(_image, header.fEnergies, fEnergies);
+        Copy(_image, header.fEnergyBegin, fEnergyBegin);
+        Copy(_image, header.fEnergyTrackIDs, fEnergyTrackIDs);
+    };
+
+private:
+    void Append(const CollisionRecord &_rec)
+    {
+        if (fTrackIDs.empty() || fTrackIDs.back() != _rec.GetTrackID())
+        {
+            fTrackIDs.push_back(_rec.GetTrackID());
+            fTrackBegin.push_back(fRows.size());
+        }
+
+        Row row;
+        row.fTrackID = _rec.GetTrackID();
+        row.fCollisionID = _rec.GetCollisionID();
+        row.fMassNumber = _rec.GetMassNumber();
+        row.fIncidentIon = GetIonIndex(_rec.GetIncidentIon());
+        row.fRecoilIon = GetIonIndex(_rec.GetRecoilIon());
+        row.fIncidentEnergy = _rec.GetIncidentEnergy();
+        row.fRecoilEnergy = _rec.GetRecoilEnergy();
+        row.fPosition = _rec.GetPosition();
+        row.fIncidentDirection = _rec.GetIncidentDirection();
+        row.fScatteringDirection = _rec.GetScatteringDirection();
+        row.fDistanceToNextCollision = _rec.GetDistanceToNextCollision();
+        row.fEnergyLoss = _rec.GetEnergyLoss();
+        fRows.push_back(row);
+    };
+
+    void BuildIndex(const std::vector<CatalogRecord> &_catalog)
+    {
+        for (const auto &rec : _catalog)
+        {
+            if (fEnergies.empty() || fEnergies.back() != rec.fEnergy)
+            {
+                fEnergies.push_back(rec.fEnergy);
+                fEnergyBegin.push_back(fEnergyTrackIDs.size());
+            }
+            fEnergyTrackIDs.push_back(rec.fTrackID);
+        }
+        fEnergyBegin.push_back(fEnergyTrackIDs.size());
+
+        // Rows ordered by the energy after the collision (ties by row)
+        fEnergyOutRow.resize(fRows.size());
+        std::iota(fEnergyOutRow.begin(), fEnergyOutRow.end(), 0);
+        auto energyOut = [this](std::size_t _i) { return fRows[_i].fIncidentEnergy - fRows[_i].fRecoilEnergy; };
+        std::stable_sort(fEnergyOutRow.begin(), fEnergyOutRow.end(),
+                         [&energyOut](std::size_t _a, std::size_t _b) { return energyOut(_a) < energyOut(_b); });
+        fEnergyOut.resize(fRows.size());
+        for (std::size_t i = 0; i < fRows.size(); ++i)
+            fEnergyOut[i] = energyOut(fEnergyOutRow[i]);
+    };
+
+    std::uint16_t GetIonIndex(const std::string &_ion)
+    {
+        auto it = std::find_if(fIons.begin(), fIons.end(),
+                               [&_ion](const IonName &_name) { return _ion == _name.fName; });
+        if (it != fIons.end())
+            return it - fIons.begin();
+        if (fIons.size() > UINT16_MAX)
+            throw std::runtime_error("CollisionLibrary : Too many ion species.");
+        if (_ion.size() >= sizeof(IonName::fName))
+            throw std::runtime_error("CollisionLibrary : Ion name too long (" + _ion + ").");
+
+        IonName name;
+        std::memset(name.fName, 0, sizeof(name.fName));
+        std::memcpy(name.fName, _ion.data(), _ion.size());
+        fIons.push_back(name);
+        return fIons.size() - 1;
+    };
+
+    // Offsets of the sections, returns the image size
+    std::size_t Layout(Header &_header) const
+    {
+        std::size_t size = sizeof(Header);
+        Place(size, _header.fRows, fRows);
+        Place(size, _header.fIons, fIons);
+        Place(size, _header.fTrackIDs, fTrackIDs);
+        Place(size, _header.fTrackBegin, fTrackBegin);
+        Place(size, _header.fEnergyOut, fEnergyOut);
+        Place(size, _header.fEnergyOutRow, fEnergyOutRow);
+        Place(size, _header.fEnergies, fEnergies);
+        Place(size, _header.fEnergyBegin, fEnergyBegin);
+        Place(size, _header.fEnergyTrackIDs, fEnergyTrackIDs);
+        return size;
+    };
+
+    template <typename T>
+    static void Place(std::size_t &_size, Section &_section, const std::vector<T> &_array)
+    {
+        _size = (_size + alignof(T) - 1) / alignof(T) * alignof(T);
+        _section.fOffset = _size;
+        _section.fCount = _array.size();
+        _size += _array.size() * sizeof(T);
+    };
+
+    template <typename T>
+    static void Copy(char *_image, const Section &_section, const std::vector<T> &_array)
+    {
+        if (!_array.empty())
+            std::memcpy(_image + _section.fOffset, _array.data(), _array.size() * sizeof(T));
+    };
+
+    std::uint64_t fSourceSize;
+    std::int64_t fSourceTime;
+
+    std::vector<Row> fRows;
+    std::vector<IonName> fIons;
+    std::vector<int> fTrackIDs;
+    std::vector<std::uint64_t> fTrackBegin;
+    std::vector<double> fEnergyOut;
+    std::vector<std::uint64_t> fEnergyOutRow;
+    std::vector<double> fEnergies;
+    std::vector<std::uint64_t> fEnergyBegin;
+    std::vector<int> fEnergyTrackIDs;
+};
+
+std::shared_ptr<const CollisionLibrary> CollisionLibrary::Load(const std::string &_fileName)
+{
+    Builder builder(_fileName);
+    const std::size_t size = builder.GetImageSize();
+    std::shared_ptr<char> image(new char[size], std::default_delete<char[]>());
+    builder.Write(image.get());
+    reinterpret_cast<Header *>(image.get())->fReady = 1;
+
+    std::shared_ptr<CollisionLibrary> library(new CollisionLibrary());
+    library->fFileName = _fileName;
+    library->fStorage = image;
+    library->Attach(image.get());
+    return library;
+}
+
+std::shared_ptr<const CollisionLibrary> CollisionLibrary::Open(const std::string &_fileName)
+{
+    return GetCached(_fileName, [&_fileName]() { return Load(_fileName); });
+}
+
+std::string CollisionLibrary::GetSharedName(const std::string &_fileName)
+{
+    // Same segment for every path of the file
+    std::string path = _fileName;
+    char resolved[PATH_MAX];
+    if (realpath(_fileName.c_str(), resolved))
+        path = resolved;
+
+    // FNV-1a
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : path)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "/TrackTrimSQLite-%016llx", static_cast<unsigned long long>(hash));
+    return name;
+}
+
+bool CollisionLibrary::RemoveShared(const std::string &_fileName)
+{
+    return shm_unlink(GetSharedName(_fileName).c_str()) == 0;
+}
+
+// Complete and up-to-date segment of _fd mapped read-only, or null.
+// _stale tells if the segment has to be replaced (null while it is being written).
+std::shared_ptr<const CollisionLibrary> CollisionLibrary::Map(const std::string &_fileName, int _fd, bool &_stale)
+{
+    _stale = false;
+    struct stat st;
+    if (fstat(_fd, &st) != 0)
+        throw std::runtime_error(ErrorString("OpenShared() fstat"));
+    if (st.st_size < static_cast<off_t>(sizeof(Header)))
+        return nullptr;
+
+    const std::size_t size = st.st_size;
+    void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (address == MAP_FAILED)
+        throw std::runtime_error(ErrorString("OpenShared() mmap"));
+    std::shared_ptr<const char> image(static_cast<const char *>(address),
+                                      [size](const char *_p) { munmap(const_cast<char *>(_p), size); });
+
+    const Header *header = reinterpret_cast<const Header *>(image.get());
+    const bool ready = *static_cast<const volatile std::uint32_t *>(&header->fReady) != 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!ready)
+        return nullptr;
+
+    std::uint64_t sourceSize = 0;
+    std::int64_t sourceTime = 0;
+    GetSourceStat(_fileName, sourceSize, sourceTime);
+    if (std::memcmp(header->fMagic, Magic, sizeof(Magic)) != 0 ||
+        header->fFormat != ImageFormat ||
+        header->fImageSize != size ||
+        header->fSourceSize != sourceSize ||
+        header->fSourceTime != sourceTime)
+    {
+        _stale = true;
+        return nullptr;
+    }
+
+    std::shared_ptr<CollisionLibrary> library(new CollisionLibrary());
+    library->fFileName = _fileName;
+    library->fShared = true;
+    library->fStorage = image;
+    library->Attach(image.get());
+    return library;
+}
+
+std::shared_ptr<const CollisionLibrary> CollisionLibrary::OpenShared(const std::string &_fileName)
+{
+    return GetCached("shm:" + _fileName, [&_fileName]() -> std::shared_ptr<const CollisionLibrary> {
+        const std::string name = GetSharedName(_fileName);
+        int nEmpty = 0;
+        while (true)
+        {
+            int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd >= 0)
+            {
+                bool stale;
+                auto library = Map(_fileName, fd, stale);
+                if (!library && !stale)
+                {
+                    // Being written : the publisher holds the lock until the segment is ready
+                    flock(fd, LOCK_SH);
+                    library = Map(_fileName, fd, stale);
+                    if (!library && !stale)
+                    {
+                        // Still not ready without a publisher : it crashed,
+                        // unless it has just created the segment and not locked it yet
+                        struct stat st;
+                        if (fstat(fd, &st) != 0 || st.st_size > 0 || ++nEmpty > 1000)
+                            stale = true;
+                        else
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    flock(fd, LOCK_UN);
+                }
+                // Processes which mapped the old segment keep it
+                if (!library && stale)
+                    UnlinkIfSame(name, fd);
+                close(fd);
+
+                if (library)
+                    return library;
+                continue;
+            }
+            if (errno != ENOENT)
+                throw std::runtime_error(ErrorString("OpenShared() shm_open " + name));
+
+            // Publish
+            fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (fd < 0)
+            {
+                if (errno == EEXIST) // another process was faster
+                    continue;
+                throw std::runtime_error(ErrorString("OpenShared() shm_open " + name));
+            }
+            try
+            {
+                flock(fd, LOCK_EX);
+                Builder builder(_fileName);
+                const std::size_t size = builder.GetImageSize();
+                if (ftruncate(fd, size) != 0)
+                    throw std::runtime_error(ErrorString("OpenShared() ftruncate"));
+                void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (address == MAP_FAILED)
+                    throw std::runtime_error(ErrorString("OpenShared() mmap"));
+                char *image = static_cast<char *>(address);
+                builder.Write(image);
+                std::atomic_thread_fence(std::memory_order_release);
+                *static_cast<volatile std::uint32_t *>(&reinterpret_cast<Header *>(image)->fReady) = 1;
+                munmap(address, size);
+
+                bool stale;
+                auto library = Map(_fileName, fd, stale);
+                flock(fd, LOCK_UN);
+                if (!library)
+                    throw std::runtime_error("CollisionLibrary::OpenShared() : Published segment not readable.");
+                close(fd);
+                return library;
+            }
+            catch (...)
+            {
+                UnlinkIfSame(name, fd);
+                close(fd);
+                throw;
+            }
+        }
+    });
+}
+
+void CollisionLibrary::Attach(const char *_image)
+{
+    const Header &header = *reinterpret_cast<const Header *>(_image);
+    fImageSize = header.fImageSize;
+    fRows = GetSection<Row>(_image, header.fRows);
+    fIons = GetSection<IonName>(_image, header.fIons);
+    fTrackIDs = GetSection<int>(_image, header.fTrackIDs);
+    fTrackBegin = GetSection<std::uint64_t>(_image, header.fTrackBegin);
+    fEnergyOut = GetSection<double>(_image, header.fEnergyOut);
+    fEnergyOutRow = GetSection<std::uint64_t>(_image, header.fEnergyOutRow);
+    fEnergies = GetSection<double>(_image, header.fEnergies);
+    fEnergyBegin = GetSection<std::uint64_t>(_image, header.fEnergyBegin);
+    fEnergyTrackIDs = GetSection<int>(_image, header.fEnergyTrackIDs);
+}
+
+Span<const int> CollisionLibrary::GetTrackIDs(double _ekin) const
+{
+    auto it = std::lower_bound(fEnergies.begin(), fEnergies.end(), _ekin);
+    if (it == fEnergies.end())
+        throw std::runtime_error("Kinetic energy out of range.");
+    const std::size_t i = it - fEnergies.begin();
+    return fEnergyTrackIDs.subspan(fEnergyBegin[i], fEnergyBegin[i + 1] - fEnergyBegin[i]);
+}
+
+std::vector<CollisionLibrary::CollisionRecord> CollisionLibrary::GetTrack(int _trackID) const
+{
+    std::vector<CollisionRecord> ret;
+    auto it = std::lower_bound(fTrackIDs.begin(), fTrackIDs.end(), _trackID);
+    if (it == fTrackIDs.end() || *it != _trackID)
+        return ret;
+
+    const std::size_t iTrack = it - fTrackIDs.begin();
+    ret.reserve(fTrackBegin[iTrack + 1] - fTrackBegin[iTrack]);
+    for (std::size_t i = fTrackBegin[iTrack]; i < fTrackBegin[iTrack + 1]; ++i)
+        ret.push_back(MakeRecord(fRows[i]));
+    return ret;
+}
+
+std::vector<CollisionLibrary::CollisionRecord>
+CollisionLibrary::GetTransferCandidates(double _ene, double _ene_min, double _ene_max,
+                                        int _trackIDMin, int _trackIDMax) const
+{
+    auto first = std::lower_bound(fEnergyOut.begin(), fEnergyOut.end(), _ene_min);
+    auto last = std::upper_bound(first, fEnergyOut.end(), _ene_max);
+
+    std::vector<std::size_t> rows;
+    for (auto it = first; it != last; ++it)
+    {
+        const std::size_t iRow = fEnergyOutRow[it - fEnergyOut.begin()];
+        const Row &row = fRows[iRow];
+        const double eNext = *it - row.fEnergyLoss;
+        if (eNext < _ene && 0 < eNext && 0 < row.fDistanceToNextCollision &&
+            (_trackIDMin < 0 || _trackIDMin <= row.fTrackID) &&
+            (_trackIDMax < 0 || row.fTrackID <= _trackIDMax))
+            rows.push_back(iRow);
+    }
+    std::sort(rows.begin(), rows.end());
+
+    std::vector<CollisionRecord> ret;
+    ret.reserve(rows.size());
+    for (auto iRow : rows)
+        ret.push_back(MakeRecord(fRows[iRow]));
+    return ret;
+}
+
+CollisionLibrary::CollisionRecord CollisionLibrary::MakeRecord(const Row &_row) const
+{
+    CollisionRecord rec;
+    rec.SetTrackID(_row.fTrackID);
+    rec.SetCollisionID(_row.fCollisionID);
+    rec.SetIncidentEnergy(_row.fIncidentEnergy);
+    rec.SetIncidentIon(fIons[_row.fIncidentIon].fName);
+    rec.SetMassNumber(_row.fMassNumber);
+    rec.SetRecoilIon(fIons[_row.fRecoilIon].fName);
+    rec.SetRecoilEnergy(_row.fRecoilEnergy);
+    // Directions were normalized when read from the DB
+    rec.SetKinematics(_row.fPosition, _row.fIncidentDirection, _row.fScatteringDirection);
+    rec.SetDistanceToNextCollision(_row.fDistanceToNextCollision);
+    rec.SetEnergyLoss(_row.fEnergyLoss);
+    return rec;
+}
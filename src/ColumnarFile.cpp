@@ -0,0 +1,491 @@
+#include "ColumnarFile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Species.hpp"
+
+namespace
+{
+    const char FileMagic[8] = {'M', 'M', 'C', 'O', 'L', 'U', 'M', 'N'};
+    const char ChunkMagic[8] = {'M', 'M', 'C', 'H', 'U', 'N', 'K', '\0'};
+    const std::uint32_t ByteOrder = 0x01020304;
+    const std::uint32_t Version = 1;
+
+    std::size_t Padded(std::size_t _n) { return (_n + 7) & ~std::size_t(7); }
+
+    template <typename T>
+    void Append(std::vector<char> &_buffer, const T &_value)
+    {
+        const char *p = reinterpret_cast<const char *>(&_value);
+        _buffer.insert(_buffer.end(), p, p + sizeof(T));
+    }
+}
+
+std::size_t ColumnarFile::GetTypeSize(Type _type)
+{
+    switch (_type)
+    {
+    case Type::Float64:
+        return 8;
+    case Type::Float32:
+    case Type::Int32:
+    case Type::UInt32:
+        return 4;
+    case Type::UInt8:
+        return 1;
+    }
+    throw std::runtime_error("ColumnarFile::GetTypeSize() :: Unknown type");
+}
+
+ColumnarFile::ColumnarFile(const std::string &_fileName, const std::vector<Column> &_columns, bool _append)
+    : fFileName(_fileName), fFile(nullptr), fColumns(_columns), fChunkSize(8 << 20),
+      fData(_columns.size()), fRowCounts(), fRows(0), fEntries(0)
+{
+    for (const auto &col : fColumns)
+    {
+        GetTypeSize(col.fType);
+        if (col.fName.size() > 0xffff)
+            throw std::runtime_error("ColumnarFile() :: Column name too long");
+    }
+
+    struct stat st;
+    if (_append && stat(_fileName.c_str(), &st) == 0 && st.st_size > 0)
+    {
+        std::uint64_t size = 0;
+        {
+            ColumnarReader reader(_fileName);
+            if (reader.GetColumns() != fColumns)
+                throw std::runtime_error("ColumnarFile() :: Columns of " + _fileName + " differ");
+            fEntries = reader.GetEntries();
+            size = reader.GetCompleteSize();
+        }
+        // Drop a chunk cut by a crash
+        if (truncate(_fileName.c_str(), off_t(size)) != 0)
+            throw std::runtime_error("ColumnarFile() :: Cannot truncate " + _fileName);
+        fFile = std::fopen(_fileName.c_str(), "ab");
+        if (!fFile)
+            throw std::runtime_error("ColumnarFile() :: Cannot open " + _fileName);
+        return;
+    }
+
+    fFile = std::fopen(_fileName.c_str(), "wb");
+    if (!fFile)
+        throw std::runtime_error("ColumnarFile() :: Cannot open " + _fileName);
+    WriteHeader();
+}
+
+ColumnarFile::~ColumnarFile()
+{
+    try
+    {
+        Close();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "ColumnarFile :: " << e.what() << std::endl;
+    }
+}
+
+void ColumnarFile::CheckColumn(std::size_t _column, Type _type) const
+{
+    if (_column >= fColumns.size())
+        throw std::runtime_error("ColumnarFile::Put() :: No column " + std::to_string(_column));
+    if (fColumns[_column].fType != _type)
+        throw std::runtime_error("ColumnarFile::Put() :: Wrong type for " + fColumns[_column].fName);
+}
+
+void ColumnarFile::EndEntry(std::size_t _nRows)
+{
+    const std::size_t entries = fRowCounts.size() + 1;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < fColumns.size(); ++i)
+    {
+        const std::size_t n = fColumns[i].fLevel == Level::Row ? fRows + _nRows : entries;
+        if (fData[i].size() != n * GetTypeSize(fColumns[i].fType))
+        {
+            // Drop the values of this entry : the chunk stays as after the last complete entry
+            for (std::size_t j = 0; j < fColumns.size(); ++j)
+            {
+                const std::size_t m = fColumns[j].fLevel == Level::Row ? fRows : fRowCounts.size();
+                fData[j].resize(std::min(fData[j].size(), m * GetTypeSize(fColumns[j].fType)));
+            }
+            throw std::runtime_error("ColumnarFile::EndEntry() :: Wrong number of values in " + fColumns[i].fName);
+        }
+        bytes += fData[i].size();
+    }
+
+    fRowCounts.push_back(std::uint32_t(_nRows));
+    fRows += _nRows;
+
+    if (bytes >= fChunkSize)
+        Flush();
+}
+
+void ColumnarFile::WriteBlock(const void *_data, std::size_t _size)
+{
+    if (_size != 0 && std::fwrite(_data, 1, _size, fFile) != _size)
+        throw std::runtime_error("ColumnarFile :: Cannot write " + fFileName);
+}
+
+void ColumnarFile::WriteHeader()
+{
+    std::vector<char> header(FileMagic, FileMagic + sizeof(FileMagic));
+    Append(header, ByteOrder);
+    Append(header, Version);
+    Append(header, std::uint32_t(fColumns.size()));
+    for (const auto &col : fColumns)
+    {
+        Append(header, std::uint8_t(col.fType));
+        Append(header, std::uint8_t(col.fLevel));
+        Append(header, std::uint16_t(col.fName.size()));
+        header.insert(header.end(), col.fName.begin(), col.fName.end());
+    }
+    header.resize(Padded(header.size()), 0);
+
+    WriteBlock(header.data(), header.size());
+    if (std::fflush(fFile) != 0)
+        throw std::runtime_error("ColumnarFile :: Cannot write " + fFileName);
+}
+
+void ColumnarFile::Flush()
+{
+    if (!fFile || fRowCounts.empty())
+        return;
+
+    const std::uint64_t entries = fRowCounts.size();
+    const std::size_t countBytes = Padded(entries * sizeof(std::uint32_t));
+
+    std::uint64_t chunkBytes = sizeof(ChunkMagic) + 3 * sizeof(std::uint64_t) +
+                               fColumns.size() * sizeof(std::uint64_t) + countBytes;
+    for (const auto &data : fData)
+        chunkBytes += Padded(data.size());
+
+    std::vector<char> header(ChunkMagic, ChunkMagic + sizeof(ChunkMagic));
+    Append(header, chunkBytes);
+    Append(header, entries);
+    Append(header, fRows);
+    for (const auto &data : fData)
+        Append(header, std::uint64_t(data.size()));
+
+    // One block per column, padded so that every column is aligned in a mapping
+    const char zeros[8] = {};
+    WriteBlock(header.data(), header.size());
+    WriteBlock(fRowCounts.data(), entries * sizeof(std::uint32_t));
+    WriteBlock(zeros, countBytes - entries * sizeof(std::uint32_t));
+    for (const auto &data : fData)
+    {
+        WriteBlock(data.data(), data.size());
+        WriteBlock(zeros, Padded(data.size()) - data.size());
+    }
+    // Complete chunks only are visible to readers and appenders
+    if (std::fflush(fFile) != 0)
+        throw std::runtime_error("ColumnarFile :: Cannot write " + fFileName);
+
+    fEntries += entries;
+    fRowCounts.clear();
+    fRows = 0;
+    for (auto &data : fData)
+        data.clear();
+}
+
+void ColumnarFile::Close()
+{
+    if (!fFile)
+        return;
+    Flush();
+    const int status = std::fclose(fFile);
+    fFile = nullptr;
+    if (status != 0)
+        throw std::runtime_error("ColumnarFile::Close() :: Cannot write " + fFileName);
+}
+
+ColumnarReader::ColumnarReader(const std::string &_fileName)
+    : fMap(nullptr), fSize(0), fColumns(), fChunks(), fCompleteSize(0)
+{
+    const int fd = open(_fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("ColumnarReader() :: Cannot open " + _fileName);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        throw std::runtime_error("ColumnarReader() :: Empty file " + _fileName);
+    }
+    fSize = std::size_t(st.st_size);
+    fMap = mmap(nullptr, fSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (fMap == MAP_FAILED)
+    {
+        fMap = nullptr;
+        throw std::runtime_error("ColumnarReader() :: Cannot map " + _fileName);
+    }
+
+    auto fail = [&](const std::string &_message) {
+        munmap(fMap, fSize);
+        fMap = nullptr;
+        throw std::runtime_error("ColumnarReader() :: " + _message + " in " + _fileName);
+    };
+
+    const char *data = static_cast<const char *>(fMap);
+    std::size_t pos = 0;
+    auto read = [&](void *_dest, std::size_t _n) {
+        if (fSize - pos < _n)
+            return false;
+        std::memcpy(_dest, data + pos, _n);
+        pos += _n;
+        return true;
+    };
+
+    char magic[8];
+    std::uint32_t order = 0, version = 0, nColumns = 0;
+    if (!read(magic, 8) || std::memcmp(magic, FileMagic, 8) != 0 ||
+        !read(&order, 4) || order != ByteOrder || !read(&version, 4) || version != Version ||
+        !read(&nColumns, 4))
+        fail("Not a columnar file of this version");
+    std::vector<std::size_t> typeSizes;
+    for (std::uint32_t i = 0; i < nColumns; ++i)
+    {
+        std::uint8_t type = 0, level = 0;
+        std::uint16_t length = 0;
+        if (!read(&type, 1) || !read(&level, 1) || !read(&length, 2) || fSize - pos < length ||
+            type < std::uint8_t(ColumnarFile::Type::Float64) || type > std::uint8_t(ColumnarFile::Type::UInt8) ||
+            (level != std::uint8_t(ColumnarFile::Level::Entry) && level != std::uint8_t(ColumnarFile::Level::Row)))
+            fail("Broken header");
+        fColumns.emplace_back(std::string(data + pos, length),
+                              ColumnarFile::Type(type), ColumnarFile::Level(level));
+        typeSizes.push_back(ColumnarFile::GetTypeSize(ColumnarFile::Type(type)));
+        pos += length;
+    }
+    pos = Padded(pos);
+    fCompleteSize = pos;
+
+    // Chunks up to the first incomplete one (cut at the end of the file by a crash).
+    // A complete chunk which contradicts itself is an error, not the end of the data.
+    const std::size_t fixed = sizeof(ChunkMagic) + 3 * sizeof(std::uint64_t) + nColumns * sizeof(std::uint64_t);
+    while (pos < fSize && fSize - pos >= fixed)
+    {
+        const char *begin = data + pos;
+        std::uint64_t chunkBytes = 0;
+        Chunk chunk;
+        if (std::memcmp(begin, ChunkMagic, 8) != 0)
+            break;
+        std::memcpy(&chunkBytes, begin + 8, 8);
+        std::memcpy(&chunk.fEntries, begin + 16, 8);
+        std::memcpy(&chunk.fRows, begin + 24, 8);
+        if (chunkBytes > fSize - pos)
+            break;
+
+        const std::string broken = "Broken chunk #" + std::to_string(fChunks.size());
+        if (chunkBytes < fixed || chunk.fEntries > (chunkBytes - fixed) / sizeof(std::uint32_t))
+            fail(broken + " (number of entries)");
+
+        chunk.fBytes.resize(nColumns);
+        std::memcpy(chunk.fBytes.data(), begin + 32, nColumns * sizeof(std::uint64_t));
+        std::uint64_t offset = fixed;
+        chunk.fRowCounts = reinterpret_cast<const std::uint32_t *>(begin + offset);
+        offset += Padded(chunk.fEntries * sizeof(std::uint32_t));
+
+        std::uint64_t rows = 0;
+        for (std::uint64_t i = 0; i < chunk.fEntries; ++i)
+            rows += chunk.fRowCounts[i];
+        if (rows != chunk.fRows)
+            fail(broken + " (number of rows)");
+
+        for (std::uint32_t i = 0; i < nColumns; ++i)
+        {
+            const std::uint64_t n = fColumns[i].fLevel == ColumnarFile::Level::Row ? chunk.fRows : chunk.fEntries;
+            if (offset > chunkBytes || n > (chunkBytes - offset) / typeSizes[i] ||
+                chunk.fBytes[i] != n * typeSizes[i])
+                fail(broken + " (size of " + fColumns[i].fName + ")");
+            chunk.fColumns.push_back(begin + offset);
+            offset += Padded(chunk.fBytes[i]);
+        }
+        if (offset != chunkBytes)
+            fail(broken + " (size)");
+
+        fChunks.push_back(std::move(chunk));
+        pos += chunkBytes;
+        fCompleteSize = pos;
+    }
+}
+
+ColumnarReader::~ColumnarReader()
+{
+    if (fMap)
+        munmap(fMap, fSize);
+}
+
+std::size_t ColumnarReader::GetColumnIndex(const std::string &_name) const
+{
+    for (std::size_t i = 0; i < fColumns.size(); ++i)
+    {
+        if (fColumns[i].fName == _name)
+            return i;
+    }
+    throw std::runtime_error("ColumnarReader::GetColumnIndex() :: No column " + _name);
+}
+
+std::uint64_t ColumnarReader::GetEntries() const
+{
+    std::uint64_t ret = 0;
+    for (const auto &chunk : fChunks)
+        ret += chunk.fEntries;
+    return ret;
+}
+
+Span<const std::uint32_t> ColumnarReader::GetRowCounts(std::size_t _chunk) const
+{
+    const Chunk &chunk = fChunks.at(_chunk);
+    return Span<const std::uint32_t>(chunk.fRowCounts, chunk.fEntries);
+}
+
+const std::vector<ColumnarFile::Column> &TrackColumnarFile::GetColumns()
+{
+    using Type = ColumnarFile::Type;
+    using Level = ColumnarFile::Level;
+    static const std::vector<ColumnarFile::Column> columns = {
+        {"ion", Type::UInt8, Level::Entry},
+        {"mass_number", Type::Int32, Level::Entry},
+        {"ene0", Type::Float64, Level::Entry},
+        {"track_id", Type::Int32, Level::Row},
+        {"collision_id", Type::Int32, Level::Row},
+        {"x", Type::Float64, Level::Row},
+        {"y", Type::Float64, Level::Row},
+        {"z", Type::Float64, Level::Row},
+        {"dr", Type::Float64, Level::Row},
+        {"ene", Type::Float64, Level::Row},
+        {"dx0", Type::Float64, Level::Row},
+        {"dy0", Type::Float64, Level::Row},
+        {"dz0", Type::Float64, Level::Row},
+        {"dx1", Type::Float64, Level::Row},
+        {"dy1", Type::Float64, Level::Row},
+        {"dz1", Type::Float64, Level::Row},
+        {"dene", Type::Float64, Level::Row},
+        {"th", Type::Float64, Level::Row},
+        {"recoil", Type::Float64, Level::Row},
+        {"atom", Type::UInt8, Level::Row}};
+    return columns;
+}
+
+TrackColumnarFile::TrackColumnarFile(const std::string &_fileName, bool _append)
+    : fFile(_fileName, GetColumns(), _append), fWritten(false)
+{
+}
+
+void TrackColumnarFile::Fill(Span<const TRIM2SQLite::CollisionRecord> _track)
+{
+    std::uint8_t ion = 0;
+    std::int32_t massNumber = 0;
+    double ene0 = 0;
+    if (_track.size() != 0)
+    {
+        ion = std::uint8_t(Species::GetCode(_track[0].GetIncidentIon()));
+        massNumber = _track[0].GetMassNumber();
+        ene0 = _track[0].GetIncidentEnergy();
+    }
+    fFile.Put(Ion, ion);
+    fFile.Put(MassNumber, massNumber);
+    fFile.Put(Energy0, ene0);
+
+    // Few species per track : remember the last name
+    const std::string *lastName = nullptr;
+    std::uint8_t lastCode = 0;
+
+    for (std::size_t i = 0; i < _track.size(); ++i)
+    {
+        const auto &col = _track[i];
+
+        fFile.Put(TrackID, std::int32_t(col.GetTrackID()));
+        fFile.Put(CollisionID, std::int32_t(col.GetCollisionID()));
+
+        const auto &pos = col.GetPosition();
+        fFile.Put(X, double(pos.X()));
+        fFile.Put(Y, double(pos.Y()));
+        fFile.Put(Z, double(pos.Z()));
+        fFile.Put(DR, double(col.GetDistanceToNextCollision()));
+        fFile.Put(Energy, double(col.GetIncidentEnergy()));
+
+        const auto &dx0 = col.GetIncidentDirection();
+        fFile.Put(DX0, double(dx0.X()));
+        fFile.Put(DY0, double(dx0.Y()));
+        fFile.Put(DZ0, double(dx0.Z()));
+
+        const auto &dx1 = col.GetScatteringDirection();
+        fFile.Put(DX1, double(dx1.X()));
+        fFile.Put(DY1, double(dx1.Y()));
+        fFile.Put(DZ1, double(dx1.Z()));
+
+        fFile.Put(DEnergy, double(col.GetEnergyLoss()));
+
+        // Scattering angle from the previous incident direction (unknown before injection)
+        double th = 0;
+        if (i != 0)
+        {
+            const auto &prev = _track[i - 1].GetIncidentDirection();
+            th = ScatteringAngle(prev.X(), prev.Y(), prev.Z(), dx0.X(), dx0.Y(), dx0.Z());
+        }
+        fFile.Put(Theta, th);
+        fFile.Put(Recoil, double(col.GetRecoilEnergy()));
+
+        const std::string &atom = col.GetRecoilIon();
+        if (!lastName || atom != *lastName)
+        {
+            lastName = &atom;
+            lastCode = std::uint8_t(Species::GetCode(atom));
+        }
+        fFile.Put(Atom, lastCode);
+    }
+
+    fFile.EndEntry(_track.size());
+}
+
+void TrackColumnarFile::Write()
+{
+    fFile.Close();
+    fWritten = true;
+}
+
+const std::vector<ColumnarFile::Column> &ClusterColumnarFile::GetColumns()
+{
+    using Type = ColumnarFile::Type;
+    using Level = ColumnarFile::Level;
+    static const std::vector<ColumnarFile::Column> columns = {
+        {"x", Type::Float64, Level::Row},
+        {"y", Type::Float64, Level::Row},
+        {"z", Type::Float64, Level::Row},
+        {"t", Type::Float64, Level::Row},
+        {"n", Type::Int32, Level::Row},
+        {"e_cls", Type::Float64, Level::Row},
+        {"e_ion", Type::Float64, Level::Row}};
+    return columns;
+}
+
+ClusterColumnarFile::ClusterColumnarFile(const std::string &_fileName, bool _append)
+    : fFile(_fileName, GetColumns(), _append), fWritten(false)
+{
+}
+
+void ClusterColumnarFile::Fill(const ClusterColumns &_clusters)
+{
+    fFile.Put(X, _clusters.x);
+    fFile.Put(Y, _clusters.y);
+    fFile.Put(Z, _clusters.z);
+    fFile.Put(T, _clusters.t);
+    fFile.Put(Electrons, _clusters.electrons);
+    fFile.Put(EnergyCluster, _clusters.ec);
+    fFile.Put(EnergyIon, _clusters.kinetic);
+    fFile.EndEntry(_clusters.size());
+}
+
+void ClusterColumnarFile::Write()
+{
+    fFile.Close();
+    fWritten = true;
+}
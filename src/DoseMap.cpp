@@ -0,0 +1,111 @@
+#include "DoseMap.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+DoseMap::DoseMap(double _xmin, double _ymin, double _zmin,
+                 double _xmax, double _ymax, double _zmax,
+                 std::size_t _nx, std::size_t _ny, std::size_t _nz)
+    : fWork(0), fEnergy(), fTotal(0), fOutside(0)
+{
+    if (_nx == 0 || _ny == 0 || _nz == 0 ||
+        !(_xmin < _xmax) || !(_ymin < _ymax) || !(_zmin < _zmax))
+    {
+        throw std::runtime_error("DoseMap() :: Invalid grid");
+    }
+
+    const double lo[3] = {_xmin, _ymin, _zmin};
+    const double hi[3] = {_xmax, _ymax, _zmax};
+    const std::size_t n[3] = {_nx, _ny, _nz};
+    for (int a = 0; a < 3; ++a)
+    {
+        fMin[a] = lo[a];
+        fN[a] = n[a];
+        fWidth[a] = (hi[a] - lo[a]) / n[a];
+        fInvWidth[a] = n[a] / (hi[a] - lo[a]);
+    }
+    fEnergy.assign(_nx * _ny * _nz, 0);
+}
+
+std::vector<double> DoseMap::GetEnergies() const
+{
+    std::vector<double> ret(fEnergy.size());
+    for (std::size_t i = 0; i < fEnergy.size(); ++i)
+        ret[i] = ToEnergy(fEnergy[i]);
+    return ret;
+}
+
+void DoseMap::Deposit(double _x, double _y, double _z, std::int64_t _e)
+{
+    fTotal += _e;
+
+    // floor() so that points just below the minimum are not taken as bin 0
+    const double u = std::floor((_x - fMin[0]) * fInvWidth[0]);
+    const double v = std::floor((_y - fMin[1]) * fInvWidth[1]);
+    const double w = std::floor((_z - fMin[2]) * fInvWidth[2]);
+    if (!(u >= 0 && u < fN[0] && v >= 0 && v < fN[1] && w >= 0 && w < fN[2]))
+    {
+        fOutside += _e;
+        return;
+    }
+    fEnergy[(std::size_t(w) * fN[1] + std::size_t(v)) * fN[0] + std::size_t(u)] += _e;
+}
+
+void DoseMap::Fill(double _x, double _y, double _z, double _e)
+{
+    Deposit(_x, _y, _z, ToFixed(_e));
+}
+
+void DoseMap::FillSegment(double _x, double _y, double _z,
+                          double _dx, double _dy, double _dz, double _e)
+{
+    // Pieces of at most half a bin along every axis, deposited at their midpoints
+    const double span = std::max({std::fabs(_dx) * fInvWidth[0],
+                                  std::fabs(_dy) * fInvWidth[1],
+                                  std::fabs(_dz) * fInvWidth[2]});
+    const std::size_t n = std::max<std::size_t>(1, std::size_t(std::ceil(2 * span)));
+
+    // The pieces carry the whole fixed-point amount, remainder on the first ones
+    const std::int64_t total = ToFixed(_e);
+    const std::int64_t piece = total / std::int64_t(n);
+    std::int64_t rest = total - piece * std::int64_t(n);
+
+    const double step = 1. / n;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const double t = (i + 0.5) * step;
+        std::int64_t e = piece;
+        if (rest > 0)
+        {
+            ++e;
+            --rest;
+        }
+        else if (rest < 0)
+        {
+            --e;
+            ++rest;
+        }
+        Deposit(_x + t * _dx, _y + t * _dy, _z + t * _dz, e);
+    }
+}
+
+void DoseMap::Add(const DoseMap &_other)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        if (fN[a] != _other.fN[a] || fMin[a] != _other.fMin[a] || fWidth[a] != _other.fWidth[a])
+            throw std::runtime_error("DoseMap::Add() :: Different grids");
+    }
+
+    for (std::size_t i = 0; i < fEnergy.size(); ++i)
+        fEnergy[i] += _other.fEnergy[i];
+    fTotal += _other.fTotal;
+    fOutside += _other.fOutside;
+}
+
+void DoseMap::Clear()
+{
+    std::fill(fEnergy.begin(), fEnergy.end(), 0);
+    fTotal = 0;
+    fOutside = 0;
+}
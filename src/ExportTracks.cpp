@@ -0,0 +1,99 @@
+#include "ExportTracks.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "CollisionDBHandler.hpp"
+#include "ParallelTreeFile.hpp"
+#include "Species.hpp"
+#include "WorkStealingPool.hpp"
+
+namespace
+{
+    template <typename Entry>
+    std::size_t Export(const std::string &_dbName, ParallelTreeFile &_file,
+                       const std::vector<int> &_trackIDs, int _nThreads, std::size_t _tracksPerTask,
+                       bool _compact)
+    {
+        const std::size_t nTasks = (_trackIDs.size() + _tracksPerTask - 1) / _tracksPerTask;
+
+        WorkStealingPool pool(_nThreads);
+        const int nThreads = pool.GetNumberOfThreads();
+        std::vector<std::unique_ptr<CollisionDBHandler>> dbs(nThreads);
+        std::vector<std::unique_ptr<ParallelTreeWriter<Entry>>> writers(nThreads);
+        std::vector<std::vector<TRIM2SQLite::CollisionRecord>> tracks(nThreads);
+
+        pool.Run(nTasks, [&](int _worker, std::size_t _i) {
+            auto &db = dbs[_worker];
+            auto &writer = writers[_worker];
+            auto &track = tracks[_worker];
+            if (!db)
+            {
+                db.reset(new CollisionDBHandler(_dbName));
+                writer.reset(new ParallelTreeWriter<Entry>(_file));
+                if (_compact)
+                    TrackTreeFile::SetCompactTreeOptions(writer->GetTree());
+            }
+
+            // IDs are sorted : the ranges of the tasks do not overlap
+            const std::size_t first = _i * _tracksPerTask;
+            const std::size_t last = std::min(first + _tracksPerTask, _trackIDs.size()) - 1;
+            track.clear();
+            db->ReadCollisions(_trackIDs[first], _trackIDs[last],
+                               [&](const TRIM2SQLite::CollisionRecord &_rec) {
+                                   if (!track.empty() && _rec.GetTrackID() != track.back().GetTrackID())
+                                   {
+                                       writer->Fill(track);
+                                       track.clear();
+                                   }
+                                   track.push_back(_rec);
+                               });
+            if (!track.empty())
+                writer->Fill(track);
+        });
+
+        // Send the remaining entries before the file is completed
+        std::size_t ret = 0;
+        for (auto &writer : writers)
+        {
+            if (writer)
+            {
+                writer->Flush();
+                ret += writer->GetEntries();
+            }
+        }
+        return ret;
+    }
+}
+
+std::size_t ExportTracks(const std::string &_dbName, const std::string &_fileName,
+                         TrackTreeFile::Schema _schema, int _nThreads, std::size_t _tracksPerTask)
+{
+    if (_tracksPerTask == 0)
+        _tracksPerTask = 1;
+
+    std::vector<int> trackIDs;
+    {
+        CollisionDBHandler db(_dbName);
+        for (const auto &rec : db.GetCatalog())
+            trackIDs.push_back(rec.fTrackID);
+    }
+    std::sort(trackIDs.begin(), trackIDs.end());
+    trackIDs.erase(std::unique(trackIDs.begin(), trackIDs.end()), trackIDs.end());
+
+    if (_schema == TrackTreeFile::Schema::Compact)
+    {
+        ParallelTreeFile file(_fileName, "tr", "tracks", TrackTreeFile::GetCompactCompression());
+        {
+            ParallelTreeWriter<SpeciesTreeEntry> species(file, "species", "species codes");
+            for (int code = 1; code < Species::NumberOfCodes; ++code)
+                species.Fill(code);
+        }
+        return Export<CompactTrackTreeEntry>(_dbName, file, trackIDs, _nThreads, _tracksPerTask, true);
+    }
+
+    ParallelTreeFile file(_fileName, "tr", "tracks");
+    return Export<TrackTreeEntry>(_dbName, file, trackIDs, _nThreads, _tracksPerTask, false);
+}
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "Geometry.hh"
+#include "Solid.hh"
+
+#include "MediumVoxelMap.hpp"
+
+namespace GarfieldSuppl
+{
+
+    using namespace Garfield;
+
+    namespace
+    {
+        /// Larger maps are refused (one byte per voxel)
+        constexpr std::size_t MaxVoxels = std::size_t(1) << 28;
+
+        Medium *GetMediumAt(Sensor *sensor, const double x, const double y, const double z)
+        {
+            Medium *medium = nullptr;
+            if (!sensor->GetMedium(x, y, z, medium))
+                return nullptr;
+            return medium;
+        }
+
+        /// Voxels [first, last] along one axis overlapping [lo, hi] (false if none)
+        bool GetVoxelRange(const double lo, const double hi, const double min, const double d,
+                           const std::size_t n, std::size_t &first, std::size_t &last)
+        {
+            const double flo = std::floor((lo - min) / d);
+            const double fhi = std::floor((hi - min) / d);
+            if (!(fhi >= 0.) || !(flo < double(n)))
+                return false;
+            first = flo > 0. ? std::size_t(flo) : 0;
+            last = fhi < double(n - 1) ? std::size_t(fhi) : n - 1;
+            return true;
+        }
+    }
+
+    bool MediumVoxelMap::Build(Sensor *sensor,
+                               const double xmin, const double ymin, const double zmin,
+                               const double xmax, const double ymax, const double zmax,
+                               const double resolution, const Geometry *geometry)
+    {
+        Clear();
+        if (!sensor || resolution <= 0. ||
+            !(xmin < xmax) || !(ymin < ymax) || !(zmin < zmax))
+        {
+            std::cerr << "MediumVoxelMap::Build: Invalid sensor, box or resolution.\n";
+            return false;
+        }
+
+        const std::size_t nx = std::max(1., std::ceil((xmax - xmin) / resolution));
+        const std::size_t ny = std::max(1., std::ceil((ymax - ymin) / resolution));
+        const std::size_t nz = std::max(1., std::ceil((zmax - zmin) / resolution));
+        if (nx > MaxVoxels / ny / nz)
+        {
+            std::cerr << "MediumVoxelMap::Build: Too many voxels ("
+                      << nx << " x " << ny << " x " << nz << "), use a coarser resolution.\n";
+            return false;
+        }
+        const double dx = (xmax - xmin) / nx;
+        const double dy = (ymax - ymin) / ny;
+        const double dz = (zmax - zmin) / nz;
+
+        // Media at the corners of two neighbouring z layers of voxels
+        const std::size_t nCorners = (nx + 1) * (ny + 1);
+        std::vector<Medium *> lower(nCorners), upper(nCorners);
+        auto sampleCorners = [&](std::vector<Medium *> &layer, const std::size_t k) {
+            const double z = k < nz ? zmin + k * dz : zmax;
+            for (std::size_t j = 0; j <= ny; ++j)
+            {
+                const double y = j < ny ? ymin + j * dy : ymax;
+                for (std::size_t i = 0; i <= nx; ++i)
+                {
+                    const double x = i < nx ? xmin + i * dx : xmax;
+                    layer[j * (nx + 1) + i] = GetMediumAt(sensor, x, y, z);
+                }
+            }
+        };
+
+        m_state.resize(nx * ny * nz);
+        sampleCorners(lower, 0);
+        for (std::size_t k = 0; k < nz; ++k)
+        {
+            sampleCorners(upper, k + 1);
+            for (std::size_t j = 0; j < ny; ++j)
+            {
+                for (std::size_t i = 0; i < nx; ++i)
+                {
+                    Medium *medium = GetMediumAt(sensor,
+                                                 xmin + (i + 0.5) * dx,
+                                                 ymin + (j + 0.5) * dy,
+                                                 zmin + (k + 0.5) * dz);
+                    bool uniform = true;
+                    for (std::size_t c = 0; c < 4 && uniform; ++c)
+                    {
+                        const std::size_t corner = (j + c / 2) * (nx + 1) + i + c % 2;
+                        uniform = lower[corner] == medium && upper[corner] == medium;
+                    }
+
+                    State state;
+                    if (!uniform)
+                    {
+                        state = Boundary;
+                        ++m_nBoundary;
+                    }
+                    else if (medium && medium->IsIonisable())
+                        state = Ionisable;
+                    else
+                        state = NotIonisable;
+                    m_state[(k * ny + j) * nx + i] = state;
+                }
+            }
+            lower.swap(upper);
+        }
+
+        // Solids the samples can step over
+        const std::size_t nSolids = geometry ? geometry->GetNumberOfSolids() : 0;
+        for (std::size_t s = 0; s < nSolids; ++s)
+        {
+            const Solid *solid = geometry->GetSolid(s);
+            double bxmin, bymin, bzmin, bxmax, bymax, bzmax;
+            if (!solid || !solid->GetBoundingBox(bxmin, bymin, bzmin, bxmax, bymax, bzmax))
+                continue;
+            // The boundary of an enclosing solid is outside the box or found by the samples
+            if (bxmin <= xmin && bymin <= ymin && bzmin <= zmin &&
+                bxmax >= xmax && bymax >= ymax && bzmax >= zmax)
+                continue;
+            std::size_t i0, i1, j0, j1, k0, k1;
+            if (!GetVoxelRange(bxmin, bxmax, xmin, dx, nx, i0, i1) ||
+                !GetVoxelRange(bymin, bymax, ymin, dy, ny, j0, j1) ||
+                !GetVoxelRange(bzmin, bzmax, zmin, dz, nz, k0, k1))
+                continue;
+            for (std::size_t k = k0; k <= k1; ++k)
+            {
+                for (std::size_t j = j0; j <= j1; ++j)
+                {
+                    for (std::size_t i = i0; i <= i1; ++i)
+                    {
+                        std::uint8_t &state = m_state[(k * ny + j) * nx + i];
+                        if (state != Boundary)
+                        {
+                            state = Boundary;
+                            ++m_nBoundary;
+                        }
+                    }
+                }
+            }
+        }
+
+        m_sensor = sensor;
+        m_geometry = geometry;
+        m_resolution = resolution;
+        m_xmin = xmin;
+        m_ymin = ymin;
+        m_zmin = zmin;
+        m_xmax = xmax;
+        m_ymax = ymax;
+        m_zmax = zmax;
+        m_invdx = 1. / dx;
+        m_invdy = 1. / dy;
+        m_invdz = 1. / dz;
+        m_nx = nx;
+        m_ny = ny;
+        m_nz = nz;
+        return true;
+    }
+
+    void MediumVoxelMap::Clear()
+    {
+        m_state.clear();
+        m_state.shrink_to_fit();
+        m_sensor = nullptr;
+        m_geometry = nullptr;
+        m_resolution = 0.;
+        m_nx = m_ny = m_nz = 0;
+        m_nBoundary = 0;
+    }
+}
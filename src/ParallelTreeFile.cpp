@@ -0,0 +1,66 @@
+#include "ParallelTreeFile.hpp"
+
+#include <stdexcept>
+
+#include <TDirectory.h>
+#include <TROOT.h>
+
+ParallelTreeFile::ParallelTreeFile(const std::string &_fileName,
+                                   const std::string &_treeName, const std::string &_treeTitle,
+                                   int _compression)
+    : fTreeName(_treeName), fTreeTitle(_treeTitle), fEntriesPerFlush(1000), fMerger()
+{
+    // Trees are made and filled on the threads of the writers
+    ROOT::EnableThreadSafety();
+    if (_compression < 0)
+        fMerger.reset(new Merger(_fileName.c_str(), "recreate"));
+    else
+        fMerger.reset(new Merger(_fileName.c_str(), "recreate", _compression));
+}
+
+std::unique_ptr<ParallelTreeFile::Writer> ParallelTreeFile::MakeWriter()
+{
+    return MakeWriter(fTreeName, fTreeTitle);
+}
+
+std::unique_ptr<ParallelTreeFile::Writer> ParallelTreeFile::MakeWriter(const std::string &_treeName,
+                                                                       const std::string &_treeTitle)
+{
+    return std::unique_ptr<Writer>(new Writer(fMerger->GetFile(), _treeName, _treeTitle,
+                                              fEntriesPerFlush));
+}
+
+ParallelTreeFile::Writer::Writer(std::shared_ptr<MergerFile> _file,
+                                 const std::string &_treeName, const std::string &_treeTitle,
+                                 long _entriesPerFlush)
+    : fFile(std::move(_file)), fTree(nullptr),
+      fEntriesPerFlush(_entriesPerFlush > 0 ? _entriesPerFlush : 1), fEntries(0), fPending(0)
+{
+    // The tree belongs to the in-memory file of this writer
+    TDirectory::TContext context(fFile.get());
+    fTree = new TTree(_treeName.c_str(), _treeTitle.c_str());
+    fTree->ResetBit(kMustCleanup);
+}
+
+ParallelTreeFile::Writer::~Writer()
+{
+    Flush();
+}
+
+void ParallelTreeFile::Writer::Fill()
+{
+    if (fTree->Fill() < 0)
+        throw std::runtime_error("ParallelTreeFile::Writer::Fill() :: TTree::Fill failed");
+    ++fEntries;
+    if (++fPending >= fEntriesPerFlush)
+        Flush();
+}
+
+void ParallelTreeFile::Writer::Flush()
+{
+    if (fPending == 0)
+        return;
+    // Queues the buffers for the merger and resets the tree
+    fFile->Write();
+    fPending = 0;
+}
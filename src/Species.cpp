@@ -0,0 +1,43 @@
+#include "Species.hpp"
+
+#include <unordered_map>
+
+namespace Species
+{
+    namespace
+    {
+        // Element symbols by atomic number
+        const char *const ElementSymbols[NumberOfCodes] = {
+            "",
+            "H", "He", "Li", "Be", "B", "C", "N", "O", "F", "Ne",
+            "Na", "Mg", "Al", "Si", "P", "S", "Cl", "Ar", "K", "Ca",
+            "Sc", "Ti", "V", "Cr", "Mn", "Fe", "Co", "Ni", "Cu", "Zn",
+            "Ga", "Ge", "As", "Se", "Br", "Kr", "Rb", "Sr", "Y", "Zr",
+            "Nb", "Mo", "Tc", "Ru", "Rh", "Pd", "Ag", "Cd", "In", "Sn",
+            "Sb", "Te", "I", "Xe", "Cs", "Ba", "La", "Ce", "Pr", "Nd",
+            "Pm", "Sm", "Eu", "Gd", "Tb", "Dy", "Ho", "Er", "Tm", "Yb",
+            "Lu", "Hf", "Ta", "W", "Re", "Os", "Ir", "Pt", "Au", "Hg",
+            "Tl", "Pb", "Bi", "Po", "At", "Rn", "Fr", "Ra", "Ac", "Th",
+            "Pa", "U", "Np", "Pu", "Am", "Cm", "Bk", "Cf", "Es", "Fm",
+            "Md", "No", "Lr", "Rf", "Db", "Sg", "Bh", "Hs", "Mt", "Ds",
+            "Rg", "Cn", "Nh", "Fl", "Mc", "Lv", "Ts", "Og"};
+    }
+
+    int GetCode(const std::string &_name)
+    {
+        static const std::unordered_map<std::string, int> codes = []() {
+            std::unordered_map<std::string, int> ret;
+            for (int i = 1; i < NumberOfCodes; ++i)
+                ret[ElementSymbols[i]] = i;
+            return ret;
+        }();
+
+        const auto it = codes.find(_name);
+        return it != codes.end() ? it->second : 0;
+    }
+
+    const char *GetName(int _code)
+    {
+        return _code > 0 && _code < NumberOfCodes ? ElementSymbols[_code] : "";
+    }
+}
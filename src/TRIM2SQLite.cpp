@@ -318,6 +318,7 @@ bool COLLISON::Next()
 }
 
 const std::string TRIM2SQLite::NameOfTable = "collisions";
+const std::string TRIM2SQLite::NameOfCatalog = "catalog";
 
 bool TRIM2SQLite::MakeSQLiteFile(const std::string &_path,
                                  const std::string &_outputname)
@@ -423,7 +424,18 @@ bool TRIM2SQLite::MakeSQLiteFile(const std::string &_path,
         throw std::runtime_error("logic error");
     }
 
+    // Append to tracks already in the library (another incident energy)
     int trackID = 0;
+    {
+        sqlite3_stmt *qNext;
+        std::string sNext = "SELECT COALESCE(MAX(track_id) + 1, 0) FROM " + NameOfTable + ";";
+        err = sqlite3_prepare_v2(pDB, sNext.c_str(), -1, &qNext, nullptr);
+        if (err == SQLITE_OK && sqlite3_step(qNext) == SQLITE_ROW)
+            trackID = sqlite3_column_int(qNext, 0);
+        sqlite3_finalize(qNext);
+    }
+    const int firstTrackID = trackID;
+
     while (col.Next() && rng.Next())
     {
 
@@ -601,6 +613,30 @@ bool TRIM2SQLite::MakeSQLiteFile(const std::string &_path,
     }
 
     sqlite3_finalize(query);
+
+    // Catalog : incident energy (= energy at collision #0) of every track,
+    // indexed by energy to select the tracks of the nearest library energy.
+    // Tracks of libraries made before the catalog are filled in as well.
+    std::ostringstream qCatalog;
+    qCatalog << "CREATE TABLE IF NOT EXISTS " << NameOfCatalog << " "
+             << "(track_id INTEGER PRIMARY KEY, e0 REAL); "
+             << "CREATE INDEX IF NOT EXISTS " << NameOfCatalog << "_e0 "
+             << "ON " << NameOfCatalog << " (e0, track_id); "
+             << "INSERT OR IGNORE INTO " << NameOfCatalog << " (track_id, e0) "
+             << "SELECT track_id, e_inc FROM " << NameOfTable << " WHERE collision_id = 0;";
+    err = sqlite3_exec(pDB, qCatalog.str().c_str(),
+                       NULL, NULL, &errMsg);
+    if (err != SQLITE_OK)
+    {
+        std::cerr << "TRIM2SQLite::MakeSQLiteFile() : Catalog is not updated. -> " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        sqlite3_close(pDB);
+        return false;
+    }
+
+    std::cout << "Tracks #" << firstTrackID << " -- " << trackID - 1
+              << " at " << rng.GetIncidentEnergy() << " eV" << std::endl;
+
     sqlite3_close(pDB);
 
     return true;
@@ -0,0 +1,325 @@
+// The scalar, AVX2 and AVX-512 kernels give bit-identical tracks only with a * b + c
+// kept unfused: CMakeLists.txt compiles this file with -ffp-contract=off
+// (GCC and clang would otherwise contract to FMA in the AVX-512 kernel).
+
+#include "TrackBatch.hpp"
+
+#include <cmath>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRACKBATCH_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    template <typename Real>
+    struct Arrays
+    {
+        const Real *m[9];
+        Real *dx, *dy, *dz;
+        const Real *dr;
+        Real *sx, *sy, *sz;
+    };
+
+    // Direction transform, normalization and step vector of collisions [_begin, _end).
+    // Every path uses the same operation order (no FMA), so they agree bit by bit.
+    template <typename Real>
+    void TransformScalar(const Arrays<Real> &_a, std::size_t _begin, std::size_t _end)
+    {
+        for (std::size_t i = _begin; i < _end; ++i)
+        {
+            Real x = _a.dx[i], y = _a.dy[i], z = _a.dz[i];
+            Real tx = _a.m[0][i] * x + _a.m[1][i] * y + _a.m[2][i] * z;
+            Real ty = _a.m[3][i] * x + _a.m[4][i] * y + _a.m[5][i] * z;
+            Real tz = _a.m[6][i] * x + _a.m[7][i] * y + _a.m[8][i] * z;
+            Real norm = std::sqrt(tx * tx + ty * ty + tz * tz);
+            if (norm > 0)
+            {
+                tx = tx / norm;
+                ty = ty / norm;
+                tz = tz / norm;
+            }
+            else
+            {
+                tx = ty = tz = 0;
+            }
+            _a.dx[i] = tx;
+            _a.dy[i] = ty;
+            _a.dz[i] = tz;
+            _a.sx[i] = _a.dr[i] * tx;
+            _a.sy[i] = _a.dr[i] * ty;
+            _a.sz[i] = _a.dr[i] * tz;
+        }
+    }
+
+#ifdef TRACKBATCH_X86
+#define TRACKBATCH_AVX2 __attribute__((target("avx2")))
+#define TRACKBATCH_AVX512 __attribute__((target("avx512f")))
+// Vector registers are passed only between functions inlined into one kernel
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+    // Lanes of the AVX2 kernel
+    struct AVX2Double
+    {
+        using Real = double;
+        using Reg = __m256d;
+        static constexpr int Width = 4;
+        TRACKBATCH_AVX2 static Reg Load(const Real *_p) { return _mm256_loadu_pd(_p); }
+        TRACKBATCH_AVX2 static void Store(Real *_p, Reg _v) { _mm256_storeu_pd(_p, _v); }
+        TRACKBATCH_AVX2 static Reg Add(Reg _a, Reg _b) { return _mm256_add_pd(_a, _b); }
+        TRACKBATCH_AVX2 static Reg Mul(Reg _a, Reg _b) { return _mm256_mul_pd(_a, _b); }
+        TRACKBATCH_AVX2 static Reg Sqrt(Reg _a) { return _mm256_sqrt_pd(_a); }
+        // _num / _den where _den > 0, otherwise 0
+        TRACKBATCH_AVX2 static Reg DivOrZero(Reg _num, Reg _den)
+        {
+            Reg valid = _mm256_cmp_pd(_den, _mm256_setzero_pd(), _CMP_GT_OQ);
+            return _mm256_and_pd(_mm256_div_pd(_num, _den), valid);
+        }
+    };
+
+    struct AVX2Float
+    {
+        using Real = float;
+        using Reg = __m256;
+        static constexpr int Width = 8;
+        TRACKBATCH_AVX2 static Reg Load(const Real *_p) { return _mm256_loadu_ps(_p); }
+        TRACKBATCH_AVX2 static void Store(Real *_p, Reg _v) { _mm256_storeu_ps(_p, _v); }
+        TRACKBATCH_AVX2 static Reg Add(Reg _a, Reg _b) { return _mm256_add_ps(_a, _b); }
+        TRACKBATCH_AVX2 static Reg Mul(Reg _a, Reg _b) { return _mm256_mul_ps(_a, _b); }
+        TRACKBATCH_AVX2 static Reg Sqrt(Reg _a) { return _mm256_sqrt_ps(_a); }
+        TRACKBATCH_AVX2 static Reg DivOrZero(Reg _num, Reg _den)
+        {
+            Reg valid = _mm256_cmp_ps(_den, _mm256_setzero_ps(), _CMP_GT_OQ);
+            return _mm256_and_ps(_mm256_div_ps(_num, _den), valid);
+        }
+    };
+
+    // Lanes of the AVX-512 kernel
+    struct AVX512Double
+    {
+        using Real = double;
+        using Reg = __m512d;
+        static constexpr int Width = 8;
+        TRACKBATCH_AVX512 static Reg Load(const Real *_p) { return _mm512_loadu_pd(_p); }
+        TRACKBATCH_AVX512 static void Store(Real *_p, Reg _v) { _mm512_storeu_pd(_p, _v); }
+        TRACKBATCH_AVX512 static Reg Add(Reg _a, Reg _b) { return _mm512_add_pd(_a, _b); }
+        TRACKBATCH_AVX512 static Reg Mul(Reg _a, Reg _b) { return _mm512_mul_pd(_a, _b); }
+        TRACKBATCH_AVX512 static Reg Sqrt(Reg _a) { return _mm512_sqrt_pd(_a); }
+        TRACKBATCH_AVX512 static Reg DivOrZero(Reg _num, Reg _den)
+        {
+            __mmask8 valid = _mm512_cmp_pd_mask(_den, _mm512_setzero_pd(), _CMP_GT_OQ);
+            return _mm512_maskz_div_pd(valid, _num, _den);
+        }
+    };
+
+    struct AVX512Float
+    {
+        using Real = float;
+        using Reg = __m512;
+        static constexpr int Width = 16;
+        TRACKBATCH_AVX512 static Reg Load(const Real *_p) { return _mm512_loadu_ps(_p); }
+        TRACKBATCH_AVX512 static void Store(Real *_p, Reg _v) { _mm512_storeu_ps(_p, _v); }
+        TRACKBATCH_AVX512 static Reg Add(Reg _a, Reg _b) { return _mm512_add_ps(_a, _b); }
+        TRACKBATCH_AVX512 static Reg Mul(Reg _a, Reg _b) { return _mm512_mul_ps(_a, _b); }
+        TRACKBATCH_AVX512 static Reg Sqrt(Reg _a) { return _mm512_sqrt_ps(_a); }
+        TRACKBATCH_AVX512 static Reg DivOrZero(Reg _num, Reg _den)
+        {
+            __mmask16 valid = _mm512_cmp_ps_mask(_den, _mm512_setzero_ps(), _CMP_GT_OQ);
+            return _mm512_maskz_div_ps(valid, _num, _den);
+        }
+    };
+
+    // Vector body for the lanes S, inlined into a function compiled for the target of S
+    template <typename S>
+    __attribute__((always_inline)) inline void TransformSIMD(const Arrays<typename S::Real> &_a,
+                                                             std::size_t _begin, std::size_t _end)
+    {
+        std::size_t i = _begin;
+        for (; i + S::Width <= _end; i += S::Width)
+        {
+            auto x = S::Load(_a.dx + i);
+            auto y = S::Load(_a.dy + i);
+            auto z = S::Load(_a.dz + i);
+
+            auto tx = S::Add(S::Add(S::Mul(S::Load(_a.m[0] + i), x), S::Mul(S::Load(_a.m[1] + i), y)),
+                             S::Mul(S::Load(_a.m[2] + i), z));
+            auto ty = S::Add(S::Add(S::Mul(S::Load(_a.m[3] + i), x), S::Mul(S::Load(_a.m[4] + i), y)),
+                             S::Mul(S::Load(_a.m[5] + i), z));
+            auto tz = S::Add(S::Add(S::Mul(S::Load(_a.m[6] + i), x), S::Mul(S::Load(_a.m[7] + i), y)),
+                             S::Mul(S::Load(_a.m[8] + i), z));
+
+            auto norm = S::Sqrt(S::Add(S::Add(S::Mul(tx, tx), S::Mul(ty, ty)), S::Mul(tz, tz)));
+            tx = S::DivOrZero(tx, norm);
+            ty = S::DivOrZero(ty, norm);
+            tz = S::DivOrZero(tz, norm);
+
+            S::Store(_a.dx + i, tx);
+            S::Store(_a.dy + i, ty);
+            S::Store(_a.dz + i, tz);
+
+            auto dr = S::Load(_a.dr + i);
+            S::Store(_a.sx + i, S::Mul(dr, tx));
+            S::Store(_a.sy + i, S::Mul(dr, ty));
+            S::Store(_a.sz + i, S::Mul(dr, tz));
+        }
+        TransformScalar(_a, i, _end);
+    }
+
+    template <typename S>
+    TRACKBATCH_AVX2 void TransformAVX2(const Arrays<typename S::Real> &_a, std::size_t _begin, std::size_t _end)
+    {
+        TransformSIMD<S>(_a, _begin, _end);
+    }
+
+    template <typename S>
+    TRACKBATCH_AVX512 void TransformAVX512(const Arrays<typename S::Real> &_a, std::size_t _begin, std::size_t _end)
+    {
+        TransformSIMD<S>(_a, _begin, _end);
+    }
+#endif
+
+    template <typename Real>
+    struct KernelEntry
+    {
+        void (*fKernel)(const Arrays<Real> &, std::size_t, std::size_t);
+        const char *fName;
+    };
+
+    template <typename Real>
+    struct SIMD;
+
+#ifdef TRACKBATCH_X86
+    template <>
+    struct SIMD<double>
+    {
+        using AVX2 = AVX2Double;
+        using AVX512 = AVX512Double;
+    };
+
+    template <>
+    struct SIMD<float>
+    {
+        using AVX2 = AVX2Float;
+        using AVX512 = AVX512Float;
+    };
+#endif
+
+    // Kernel _name ("" : the fastest one the CPU supports), false if not available
+    template <typename Real>
+    bool FindKernel(const std::string &_name, KernelEntry<Real> &_kernel)
+    {
+#ifdef TRACKBATCH_X86
+        __builtin_cpu_init();
+        if ((_name.empty() || _name == "avx512f") && __builtin_cpu_supports("avx512f"))
+        {
+            _kernel = {TransformAVX512<typename SIMD<Real>::AVX512>, "avx512f"};
+            return true;
+        }
+        if ((_name.empty() || _name == "avx2") && __builtin_cpu_supports("avx2"))
+        {
+            _kernel = {TransformAVX2<typename SIMD<Real>::AVX2>, "avx2"};
+            return true;
+        }
+#endif
+        if (_name.empty() || _name == "scalar")
+        {
+            _kernel = {TransformScalar<Real>, "scalar"};
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Real>
+    KernelEntry<Real> &GetKernel()
+    {
+        static KernelEntry<Real> kernel = []() {
+            KernelEntry<Real> ret;
+            FindKernel<Real>("", ret);
+            return ret;
+        }();
+        return kernel;
+    }
+}
+
+template <typename Real>
+void BasicTrackBatch<Real>::Resize(std::size_t _n)
+{
+    fSize = _n;
+    fDx.resize(_n);
+    fDy.resize(_n);
+    fDz.resize(_n);
+    fDr.resize(_n);
+    for (auto &m : fM)
+        m.resize(_n);
+    fX.resize(_n);
+    fY.resize(_n);
+    fZ.resize(_n);
+}
+
+template <typename Real>
+void BasicTrackBatch<Real>::Apply(const Vector &_start)
+{
+    ApplyFrom(_start.X(), _start.Y(), _start.Z());
+}
+
+template <typename Real>
+void BasicTrackBatch<Real>::Continue()
+{
+    ApplyFrom(fEndX, fEndY, fEndZ);
+}
+
+template <typename Real>
+void BasicTrackBatch<Real>::ApplyFrom(double _x, double _y, double _z)
+{
+    fEndX = _x;
+    fEndY = _y;
+    fEndZ = _z;
+    if (fSize == 0)
+        return;
+
+    Arrays<Real> a;
+    for (int iM = 0; iM < 9; ++iM)
+        a.m[iM] = fM[iM].data();
+    a.dx = fDx.data();
+    a.dy = fDy.data();
+    a.dz = fDz.data();
+    a.dr = fDr.data();
+    a.sx = fX.data();
+    a.sy = fY.data();
+    a.sz = fZ.data();
+
+    GetKernel<Real>().fKernel(a, 0, fSize);
+
+    // Prefix sum of the step vectors -> positions (in place, sequential order)
+    double x = _x, y = _y, z = _z;
+    for (std::size_t i = 0; i < fSize; ++i)
+    {
+        double sx = fX[i], sy = fY[i], sz = fZ[i];
+        fX[i] = x;
+        fY[i] = y;
+        fZ[i] = z;
+        x += sx;
+        y += sy;
+        z += sz;
+    }
+    fEndX = x;
+    fEndY = y;
+    fEndZ = z;
+}
+
+template <typename Real>
+const char *BasicTrackBatch<Real>::GetKernelName()
+{
+    return GetKernel<Real>().fName;
+}
+
+template <typename Real>
+bool BasicTrackBatch<Real>::SetKernel(const std::string &_name)
+{
+    return FindKernel<Real>(_name, GetKernel<Real>());
+}
+
+template class BasicTrackBatch<double>;
+template class BasicTrackBatch<float>;
@@ -1,108 +1,286 @@
 #include "TrackTreeFile.hpp"
 
-namespace
+#include <RVersion.h>
+#include <TROOT.h>
+
+template <typename Entry>
+struct TrackTreeFile::BufferOf : public TrackTreeFile::Buffer
+{
+    Entry fEntry;
+
+    void Branch(TTree &_tree) override { fEntry.Branch(_tree); };
+    void Assign(Span<const TRIM2SQLite::CollisionRecord> _track) override { fEntry.Assign(_track); };
+    void Clear() override { fEntry.Clear(); };
+    void Swap(Buffer &_other) override { fEntry.Swap(static_cast<BufferOf &>(_other).fEntry); };
+    Buffer *New() const override { return new BufferOf(); };
+};
+
+TrackTreeFile::TrackTreeFile(const std::string &_fileName, Schema _schema)
+    : fFile(_fileName.c_str(), "recreate"), fTree("tr", "tracks"), fWritten(false),
+      fSchema(_schema), fEntry(), fWriter(), fMutex(), fCondition(), fNumberOfBuffers(0),
+      fQueue(), fFree(), fStop(false), fError()
+{
+    if (fSchema == Schema::Compact)
+    {
+        fEntry.reset(new BufferOf<CompactTrackTreeEntry>());
+        if (GetCompactCompression() >= 0)
+            fFile.SetCompressionSettings(GetCompactCompression());
+        fEntry->Branch(fTree);
+        SetCompactTreeOptions(fTree);
+    }
+    else
+    {
+        fEntry.reset(new BufferOf<TrackTreeEntry>());
+        fEntry->Branch(fTree);
+    }
+};
+
+TrackTreeFile::~TrackTreeFile()
+{
+    try
+    {
+        DisableAsyncWrite();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "TrackTreeFile :: Writer thread failed : " << e.what() << std::endl;
+    }
+
+    if (!IsWritten())
+    {
+        Write();
+    }
+};
+
+bool TrackTreeFile::IsOpen() const { return fFile.IsOpen(); };
+
+void TrackTreeFile::Fill(Span<const TRIM2SQLite::CollisionRecord> _track)
+{
+    if (!IsAsyncWriteEnabled())
+    {
+        fEntry->Assign(_track);
+        fTree.Fill();
+        return;
+    }
+
+    // Back-pressure : wait for a buffer the writer thread has finished with
+    std::unique_ptr<Buffer> entry;
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        fCondition.wait(lock, [this]() { return !fFree.empty() || fError; });
+        CheckWriter();
+        entry = std::move(fFree.front());
+        fFree.pop_front();
+    }
+
+    entry->Assign(_track);
+
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fQueue.push_back(std::move(entry));
+    }
+    fCondition.notify_all();
+};
+
+void TrackTreeFile::EnableAsyncWrite(std::size_t _nBuffers)
+{
+    DisableAsyncWrite();
+
+    // The tree is filled on another thread than the one which created it
+    ROOT::EnableThreadSafety();
+
+    fNumberOfBuffers = _nBuffers > 0 ? _nBuffers : 1;
+    for (std::size_t i = 0; i < fNumberOfBuffers; ++i)
+        fFree.push_back(std::unique_ptr<Buffer>(fEntry->New()));
+    fStop = false;
+    fWriter = std::thread(&TrackTreeFile::RunWriter, this);
+};
+
+void TrackTreeFile::DisableAsyncWrite()
+{
+    if (!IsAsyncWriteEnabled())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fStop = true;
+    }
+    fCondition.notify_all();
+    // The writer thread drains the queue before it returns
+    fWriter.join();
+
+    std::lock_guard<std::mutex> lock(fMutex);
+    fQueue.clear();
+    fFree.clear();
+    fNumberOfBuffers = 0;
+    CheckWriter();
+};
+
+void TrackTreeFile::Flush()
 {
+    if (!IsAsyncWriteEnabled())
+        return;
 
-    template <typename T>
-    std::vector<T> MakeScatteringAngleVector(const std::vector<T> &_vdx,
-                                             const std::vector<T> &_vdy,
-                                             const std::vector<T> &_vdz)
+    std::unique_lock<std::mutex> lock(fMutex);
+    fCondition.wait(lock, [this]() { return fFree.size() == fNumberOfBuffers || fError; });
+    CheckWriter();
+};
+
+void TrackTreeFile::RunWriter()
+{
+    for (;;)
     {
+        std::unique_ptr<Buffer> entry;
+        {
+            std::unique_lock<std::mutex> lock(fMutex);
+            fCondition.wait(lock, [this]() { return !fQueue.empty() || fStop; });
+            if (fQueue.empty())
+                return;
+            entry = std::move(fQueue.front());
+            fQueue.pop_front();
+        }
 
-        std::vector<T> ret;
-        const int vec_size = _vdx.size();
-        if (vec_size != _vdy.size() || vec_size != _vdz.size())
+        // Only this thread touches fEntry and the tree while the writer runs
+        std::exception_ptr error;
+        try
+        {
+            fEntry->Swap(*entry);
+            if (fTree.Fill() < 0)
+                throw std::runtime_error("TrackTreeFile::Fill() :: TTree::Fill failed");
+        }
+        catch (...)
         {
-            throw std::runtime_error("MakeScatteringAngleVector :: size mismatch");
+            error = std::current_exception();
         }
-        ret.reserve(vec_size);
 
-        for (int i = 0; i < vec_size; ++i)
         {
-            if (i == 0)
-            {
-                ret.push_back(0); // Dont know before injection
-            }
-            else // last
-            {
-
-                double angle = -1000;
-
-                double x_f = _vdx.at(i - 1);
-                double x_l = _vdx.at(i);
-                double y_f = _vdy.at(i - 1);
-                double y_l = _vdy.at(i);
-                double z_f = _vdz.at(i - 1);
-                double z_l = _vdz.at(i);
-
-                double inner_prd = x_f * x_l + y_f * y_l + z_f * z_l;
-                double amp_f = sqrt(x_f * x_f + y_f * y_f + z_f * z_f);
-                double amp_l = sqrt(x_l * x_l + y_l * y_l + z_l * z_l);
-
-                if (amp_f > 0 && amp_l > 0)
-                    angle = acos(inner_prd / amp_f / amp_l) / M_PI * 180;
-
-                ret.push_back(angle);
-            }
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (error && !fError)
+                fError = error;
+            fFree.push_back(std::move(entry));
         }
-        return ret;
-    }
-}
-
-TrackTreeFile::TrackTreeFile(const std::string &_fileName)
-    : fFile(_fileName.c_str(), "recreate"), fTree("tr", "tracks"), fWritten(false)
-{
-
-    fTree.Branch("ion", &ion);
-    fTree.Branch("mass_number", &mass_number, "mass_number/I");
-    fTree.Branch("ene0", &ene0, "ene0/D");
-    fTree.Branch("track_id", &track_id);
-    fTree.Branch("collision_id", &collision_id);
-    fTree.Branch("x", &vX);
-    fTree.Branch("y", &vY);
-    fTree.Branch("z", &vZ);
-    fTree.Branch("dr", &vdR);
-    fTree.Branch("ene", &vEne);
-    fTree.Branch("dx0", &vdX0);
-    fTree.Branch("dy0", &vdY0);
-    fTree.Branch("dz0", &vdZ0);
-    fTree.Branch("dx1", &vdX1);
-    fTree.Branch("dy1", &vdY1);
-    fTree.Branch("dz1", &vdZ1);
-    fTree.Branch("dene", &vdEne);
-    fTree.Branch("th", &vTh);
-    fTree.Branch("recoil", &vRecoil);
-    fTree.Branch("atom", &vAtom);
+        fCondition.notify_all();
+    }
 };
 
-TrackTreeFile::~TrackTreeFile()
+void TrackTreeFile::CheckWriter()
 {
-    if (!IsWritten())
+    if (fError)
     {
-        Write();
+        std::exception_ptr error = fError;
+        fError = nullptr;
+        std::rethrow_exception(error);
     }
 };
 
-bool TrackTreeFile::IsOpen() const { return fFile.IsOpen(); };
+void TrackTreeFile::Write()
+{
+    Flush();
 
-void TrackTreeFile::Fill(std::vector<TRIM2SQLite::CollisionRecord> _track)
+    if (IsOpen())
+    {
+        if (fSchema == Schema::Compact && !fWritten)
+            WriteSpecies();
+        fTree.Write();
+        fWritten = true;
+    }
+};
+
+int TrackTreeFile::GetCompactCompression()
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 20, 0)
+    // zstd level 5: smaller than the default zlib and faster to decompress
+    return 505;
+#else
+    return -1;
+#endif
+}
+
+void TrackTreeFile::SetCompactTreeOptions(TTree &_tree)
+{
+    // Clusters of about 10 MB (compressed) instead of 30 MB :
+    // less memory per cluster on reading and in the writer thread,
+    // large enough baskets for the float branches from the start
+    _tree.SetAutoFlush(-10000000);
+    _tree.SetBasketSize("*", 128000);
+}
+
+void TrackTreeFile::WriteSpecies()
+{
+    TDirectory::TContext context(&fFile);
+    TTree species("species", "species codes");
+    SpeciesTreeEntry entry;
+    entry.Branch(species);
+    for (int code = 1; code < Species::NumberOfCodes; ++code)
+    {
+        entry.Assign(code);
+        species.Fill();
+    }
+    species.Write();
+}
+
+void SpeciesTreeEntry::Branch(TTree &_tree)
+{
+    _tree.Branch("code", &code, "code/I");
+    _tree.Branch("name", &name);
+}
+
+void SpeciesTreeEntry::Assign(int _code)
+{
+    code = _code;
+    name = Species::GetName(_code);
+}
+
+void TrackTreeFile::Clear()
+{
+    Flush();
+    fEntry->Clear();
+}
+
+void TrackTreeEntry::Branch(TTree &_tree)
+{
+    _tree.Branch("ion", &ion);
+    _tree.Branch("mass_number", &mass_number, "mass_number/I");
+    _tree.Branch("ene0", &ene0, "ene0/D");
+    _tree.Branch("track_id", &track_id);
+    _tree.Branch("collision_id", &collision_id);
+    _tree.Branch("x", &vX);
+    _tree.Branch("y", &vY);
+    _tree.Branch("z", &vZ);
+    _tree.Branch("dr", &vdR);
+    _tree.Branch("ene", &vEne);
+    _tree.Branch("dx0", &vdX0);
+    _tree.Branch("dy0", &vdY0);
+    _tree.Branch("dz0", &vdZ0);
+    _tree.Branch("dx1", &vdX1);
+    _tree.Branch("dy1", &vdY1);
+    _tree.Branch("dz1", &vdZ1);
+    _tree.Branch("dene", &vdEne);
+    _tree.Branch("th", &vTh);
+    _tree.Branch("recoil", &vRecoil);
+    _tree.Branch("atom", &vAtom);
+}
+
+void TrackTreeEntry::Assign(Span<const TRIM2SQLite::CollisionRecord> _track)
 {
     Clear();
+    Reserve(_track.size());
 
     if (_track.size() != 0)
     {
-        ion = _track.front().GetIncidentIon();
-        mass_number = _track.front().GetMassNumber();
-        ene0 = _track.front().GetIncidentEnergy();
+        ion = _track[0].GetIncidentIon();
+        mass_number = _track[0].GetMassNumber();
+        ene0 = _track[0].GetIncidentEnergy();
     }
 
-    for (auto &col : _track)
+    for (std::size_t i = 0; i < _track.size(); ++i)
     {
+        const auto &col = _track[i];
 
         track_id.push_back(col.GetTrackID());
         collision_id.push_back(col.GetCollisionID());
 
-        auto pos = col.GetPosition();
+        const auto &pos = col.GetPosition();
         vX.push_back(pos.X());
         vY.push_back(pos.Y());
         vZ.push_back(pos.Z());
@@ -110,12 +288,12 @@ void TrackTreeFile::Fill(std::vector<TRIM2SQLite::CollisionRecord> _track)
 
         vdR.push_back(col.GetDistanceToNextCollision());
 
-        auto dx0 = col.GetIncidentDirection();
+        const auto &dx0 = col.GetIncidentDirection();
         vdX0.push_back(dx0.X());
         vdY0.push_back(dx0.Y());
         vdZ0.push_back(dx0.Z());
 
-        auto dx1 = col.GetScatteringDirection();
+        const auto &dx1 = col.GetScatteringDirection();
         vdX1.push_back(dx1.X());
         vdY1.push_back(dx1.Y());
         vdZ1.push_back(dx1.Z());
@@ -123,25 +301,243 @@ void TrackTreeFile::Fill(std::vector<TRIM2SQLite::CollisionRecord> _track)
         vdEne.push_back(col.GetEnergyLoss());
         vRecoil.push_back(col.GetRecoilEnergy());
         vAtom.push_back(col.GetRecoilIon());
+
+        // Scattering angle from the previous incident direction (unknown before injection)
+        if (i == 0)
+            vTh.push_back(0);
+        else
+            vTh.push_back(ScatteringAngle(vdX0[i - 1], vdY0[i - 1], vdZ0[i - 1],
+                                          vdX0[i], vdY0[i], vdZ0[i]));
+    }
+};
+
+void TrackTreeEntry::Reserve(std::size_t _n)
+{
+    track_id.reserve(_n);
+    collision_id.reserve(_n);
+
+    vX.reserve(_n);
+    vY.reserve(_n);
+    vZ.reserve(_n);
+    vEne.reserve(_n);
+    vdR.reserve(_n);
+    vdX0.reserve(_n);
+    vdY0.reserve(_n);
+    vdZ0.reserve(_n);
+    vdX1.reserve(_n);
+    vdY1.reserve(_n);
+    vdZ1.reserve(_n);
+    vTh.reserve(_n);
+    vdEne.reserve(_n);
+    vAtom.reserve(_n);
+    vRecoil.reserve(_n);
+}
+
+void TrackTreeEntry::Clear()
+{
+
+    ion = "";
+    mass_number = 0;
+    ene0 = 0;
+    track_id.clear();
+    collision_id.clear();
+
+    vX.clear();
+    vY.clear();
+    vZ.clear();
+    vEne.clear();
+    vdR.clear();
+    vdX0.clear();
+    vdY0.clear();
+    vdZ0.clear();
+    vdX1.clear();
+    vdY1.clear();
+    vdZ1.clear();
+    vTh.clear();
+    vdEne.clear();
+    vAtom.clear();
+    vRecoil.clear();
+}
+
+void TrackTreeEntry::Swap(TrackTreeEntry &_other)
+{
+    ion.swap(_other.ion);
+    std::swap(mass_number, _other.mass_number);
+    std::swap(ene0, _other.ene0);
+    track_id.swap(_other.track_id);
+    collision_id.swap(_other.collision_id);
+
+    vX.swap(_other.vX);
+    vY.swap(_other.vY);
+    vZ.swap(_other.vZ);
+    vEne.swap(_other.vEne);
+    vdR.swap(_other.vdR);
+    vdX0.swap(_other.vdX0);
+    vdY0.swap(_other.vdY0);
+    vdZ0.swap(_other.vdZ0);
+    vdX1.swap(_other.vdX1);
+    vdY1.swap(_other.vdY1);
+    vdZ1.swap(_other.vdZ1);
+    vTh.swap(_other.vTh);
+    vdEne.swap(_other.vdEne);
+    vAtom.swap(_other.vAtom);
+    vRecoil.swap(_other.vRecoil);
+}
+
+void ClusterTreeEntry::Branch(TTree &_tree)
+{
+    _tree.Branch("x", &vx);
+    _tree.Branch("y", &vy);
+    _tree.Branch("z", &vz);
+    _tree.Branch("t", &vt);
+    _tree.Branch("n", &vn);
+    _tree.Branch("e_cls", &ve_cls);
+    _tree.Branch("e_ion", &ve_ion);
+}
+
+void ClusterTreeEntry::Clear()
+{
+    vx.clear();
+    vy.clear();
+    vz.clear();
+    vt.clear();
+    vn.clear();
+    ve_cls.clear();
+    ve_ion.clear();
+}
+
+ClusterTreeFile::ClusterTreeFile(const std::string &_fileName, const std::string &_treeName)
+    : fFile(_fileName.c_str(), "recreate"), fTree(_treeName.c_str(), "clusters"), fEntry(), fWritten(false)
+{
+    fEntry.Branch(fTree);
+}
+
+ClusterTreeFile::~ClusterTreeFile()
+{
+    if (!IsWritten())
+    {
+        Write();
     }
+}
 
-    vTh = MakeScatteringAngleVector(vdX0, vdY0, vdZ0);
+bool ClusterTreeFile::IsOpen() const { return fFile.IsOpen(); }
+
+void ClusterTreeFile::Fill(const ClusterColumns &_clusters)
+{
+    fEntry.Assign(_clusters);
     fTree.Fill();
-};
+}
 
-void TrackTreeFile::Write()
+void ClusterTreeFile::Write()
 {
     if (IsOpen())
     {
         fTree.Write();
         fWritten = true;
     }
-};
+}
 
-void TrackTreeFile::Clear()
+void CompactTrackTreeEntry::Branch(TTree &_tree)
 {
+    _tree.Branch("ion", &ion, "ion/I");
+    _tree.Branch("mass_number", &mass_number, "mass_number/I");
+    _tree.Branch("ene0", &ene0, "ene0/D");
+    _tree.Branch("track_id", &track_id);
+    _tree.Branch("collision_id", &collision_id);
+    _tree.Branch("x", &vX);
+    _tree.Branch("y", &vY);
+    _tree.Branch("z", &vZ);
+    _tree.Branch("dr", &vdR);
+    _tree.Branch("ene", &vEne);
+    _tree.Branch("dx0", &vdX0);
+    _tree.Branch("dy0", &vdY0);
+    _tree.Branch("dz0", &vdZ0);
+    _tree.Branch("dx1", &vdX1);
+    _tree.Branch("dy1", &vdY1);
+    _tree.Branch("dz1", &vdZ1);
+    _tree.Branch("dene", &vdEne);
+    _tree.Branch("recoil", &vRecoil);
+    _tree.Branch("atom", &vAtom);
+}
 
-    ion = "";
+void CompactTrackTreeEntry::Assign(Span<const TRIM2SQLite::CollisionRecord> _track)
+{
+    Clear();
+    Reserve(_track.size());
+
+    if (_track.size() != 0)
+    {
+        ion = Species::GetCode(_track[0].GetIncidentIon());
+        mass_number = _track[0].GetMassNumber();
+        ene0 = _track[0].GetIncidentEnergy();
+    }
+
+    // Few species per track : remember the last name
+    const std::string *lastName = nullptr;
+    unsigned char lastCode = 0;
+
+    for (std::size_t i = 0; i < _track.size(); ++i)
+    {
+        const auto &col = _track[i];
+
+        track_id.push_back(col.GetTrackID());
+        collision_id.push_back(col.GetCollisionID());
+
+        const auto &pos = col.GetPosition();
+        vX.push_back(pos.X());
+        vY.push_back(pos.Y());
+        vZ.push_back(pos.Z());
+        vEne.push_back(col.GetIncidentEnergy());
+
+        vdR.push_back(col.GetDistanceToNextCollision());
+
+        const auto &dx0 = col.GetIncidentDirection();
+        vdX0.push_back(dx0.X());
+        vdY0.push_back(dx0.Y());
+        vdZ0.push_back(dx0.Z());
+
+        const auto &dx1 = col.GetScatteringDirection();
+        vdX1.push_back(dx1.X());
+        vdY1.push_back(dx1.Y());
+        vdZ1.push_back(dx1.Z());
+
+        vdEne.push_back(col.GetEnergyLoss());
+        vRecoil.push_back(col.GetRecoilEnergy());
+
+        const std::string &atom = col.GetRecoilIon();
+        if (!lastName || atom != *lastName)
+        {
+            lastName = &atom;
+            lastCode = Species::GetCode(atom);
+        }
+        vAtom.push_back(lastCode);
+    }
+}
+
+void CompactTrackTreeEntry::Reserve(std::size_t _n)
+{
+    track_id.reserve(_n);
+    collision_id.reserve(_n);
+
+    vX.reserve(_n);
+    vY.reserve(_n);
+    vZ.reserve(_n);
+    vEne.reserve(_n);
+    vdR.reserve(_n);
+    vdX0.reserve(_n);
+    vdY0.reserve(_n);
+    vdZ0.reserve(_n);
+    vdX1.reserve(_n);
+    vdY1.reserve(_n);
+    vdZ1.reserve(_n);
+    vdEne.reserve(_n);
+    vAtom.reserve(_n);
+    vRecoil.reserve(_n);
+}
+
+void CompactTrackTreeEntry::Clear()
+{
+    ion = 0;
     mass_number = 0;
     ene0 = 0;
     track_id.clear();
@@ -158,8 +554,31 @@ void TrackTreeFile::Clear()
     vdX1.clear();
     vdY1.clear();
     vdZ1.clear();
-    vTh.clear();
     vdEne.clear();
     vAtom.clear();
     vRecoil.clear();
-}
\ No newline at end of file
+}
+
+void CompactTrackTreeEntry::Swap(CompactTrackTreeEntry &_other)
+{
+    std::swap(ion, _other.ion);
+    std::swap(mass_number, _other.mass_number);
+    std::swap(ene0, _other.ene0);
+    track_id.swap(_other.track_id);
+    collision_id.swap(_other.collision_id);
+
+    vX.swap(_other.vX);
+    vY.swap(_other.vY);
+    vZ.swap(_other.vZ);
+    vEne.swap(_other.vEne);
+    vdR.swap(_other.vdR);
+    vdX0.swap(_other.vdX0);
+    vdY0.swap(_other.vdY0);
+    vdZ0.swap(_other.vdZ0);
+    vdX1.swap(_other.vdX1);
+    vdY1.swap(_other.vdY1);
+    vdZ1.swap(_other.vdZ1);
+    vdEne.swap(_other.vdEne);
+    vAtom.swap(_other.vAtom);
+    vRecoil.swap(_other.vRecoil);
+}
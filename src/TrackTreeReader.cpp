@@ -0,0 +1,147 @@
+#include "TrackTreeReader.hpp"
+
+#include <algorithm>
+
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+
+TrackTreeReader::TrackTreeReader(const std::string &_fileName, const std::string &_treeName)
+    : fFileName(_fileName), fTreeName(_treeName), fBranches(), fEntriesPerTask(0),
+      fMain(), fMainView()
+{
+    // Every thread of ParallelForEach opens the file
+    ROOT::EnableThreadSafety();
+
+    fMain = Open();
+    SetBranches(GetBranchNames());
+}
+
+std::vector<std::string> TrackTreeReader::GetBranchNames() const
+{
+    std::vector<std::string> ret;
+    TObjArray *branches = fMain->fTree->GetListOfBranches();
+    for (int i = 0; i < branches->GetEntriesFast(); ++i)
+        ret.push_back(branches->At(i)->GetName());
+    return ret;
+}
+
+void TrackTreeReader::SetBranches(const std::vector<std::string> &_names)
+{
+    if (_names.empty())
+        throw std::runtime_error("TrackTreeReader::SetBranches() :: No branch");
+    for (const auto &name : _names)
+    {
+        if (!fMain->fTree->GetBranch(name.c_str()))
+            throw std::runtime_error("TrackTreeReader::SetBranches() :: No branch " + name + " in " + fFileName);
+    }
+
+    fBranches = _names;
+    fMain = Open();
+    fMainView.reset(new View(fBranches, *fMain));
+}
+
+std::unique_ptr<TrackTreeReader::Slot> TrackTreeReader::MakeSlot(TBranch &_branch)
+{
+    const std::string className = _branch.GetClassName();
+    if (className == "vector<double>")
+        return std::unique_ptr<Slot>(new ObjectSlot<std::vector<double>>());
+    if (className == "vector<float>")
+        return std::unique_ptr<Slot>(new ObjectSlot<std::vector<float>>());
+    if (className == "vector<int>")
+        return std::unique_ptr<Slot>(new ObjectSlot<std::vector<int>>());
+    if (className == "vector<unsigned char>")
+        return std::unique_ptr<Slot>(new ObjectSlot<std::vector<unsigned char>>());
+    if (className == "vector<string>")
+        return std::unique_ptr<Slot>(new ObjectSlot<std::vector<std::string>>());
+    if (className == "string")
+        return std::unique_ptr<Slot>(new ObjectSlot<std::string>());
+
+    // Leaf list of one value
+    TObjArray *leaves = _branch.GetListOfLeaves();
+    if (className.empty() && leaves->GetEntriesFast() == 1)
+    {
+        const std::string typeName = static_cast<TLeaf *>(leaves->At(0))->GetTypeName();
+        if (typeName == "Double_t")
+            return std::unique_ptr<Slot>(new ValueSlot<double>());
+        if (typeName == "Float_t")
+            return std::unique_ptr<Slot>(new ValueSlot<float>());
+        if (typeName == "Int_t")
+            return std::unique_ptr<Slot>(new ValueSlot<int>());
+    }
+    throw std::runtime_error(std::string("TrackTreeReader :: Unsupported type of branch ") + _branch.GetName());
+}
+
+std::unique_ptr<TrackTreeReader::Source> TrackTreeReader::Open() const
+{
+    std::unique_ptr<Source> source(new Source());
+    source->fFile.reset(TFile::Open(fFileName.c_str(), "read"));
+    if (!source->fFile || source->fFile->IsZombie())
+        throw std::runtime_error("TrackTreeReader :: Cannot open " + fFileName);
+    source->fFile->GetObject(fTreeName.c_str(), source->fTree);
+    if (!source->fTree)
+        throw std::runtime_error("TrackTreeReader :: No tree " + fTreeName + " in " + fFileName);
+
+    // Disabled branches are neither read nor decompressed
+    TTree &tree = *source->fTree;
+    tree.SetBranchStatus("*", 0);
+    for (const auto &name : fBranches)
+    {
+        TBranch *branch = tree.GetBranch(name.c_str());
+        if (!branch)
+            throw std::runtime_error("TrackTreeReader :: No branch " + name + " in " + fFileName);
+        tree.SetBranchStatus(name.c_str(), 1);
+        source->fSlots.push_back(MakeSlot(*branch));
+        source->fSlots.back()->Bind(tree, name.c_str());
+        // Prefetch these branches only
+        tree.AddBranchToCache(branch, true);
+    }
+    return source;
+}
+
+void TrackTreeReader::Read(Source &_source, Long64_t _entry) const
+{
+    if (_source.fTree->GetEntry(_entry) <= 0)
+        throw std::runtime_error("TrackTreeReader :: Cannot read entry " + std::to_string(_entry) +
+                                 " of " + fFileName);
+}
+
+const TrackTreeReader::View &TrackTreeReader::Read(Long64_t _entry)
+{
+    Read(*fMain, _entry);
+    fMainView->fEntry = _entry;
+    return *fMainView;
+}
+
+std::vector<std::pair<Long64_t, Long64_t>> TrackTreeReader::GetRanges(Long64_t _begin, Long64_t _end,
+                                                                      Long64_t _maxEntries) const
+{
+    std::vector<std::pair<Long64_t, Long64_t>> ret;
+    if (_begin >= _end)
+        return ret;
+
+    auto cluster = fMain->fTree->GetClusterIterator(_begin);
+    Long64_t start = cluster();
+    while (start < _end)
+    {
+        Long64_t stop = cluster.GetNextEntry();
+        if (start < _begin)
+            start = _begin;
+        if (stop > _end || stop <= start)
+            stop = _end;
+        for (Long64_t first = start; first < stop; first += _maxEntries)
+            ret.emplace_back(first, std::min(first + _maxEntries, stop));
+        start = cluster();
+    }
+    return ret;
+}
+
+std::size_t TrackTreeReader::View::GetIndex(const std::string &_name) const
+{
+    for (std::size_t i = 0; i < fNames->size(); ++i)
+    {
+        if ((*fNames)[i] == _name)
+            return i;
+    }
+    throw std::runtime_error("TrackTreeReader::View::GetIndex() :: Branch " + _name + " is not selected");
+}
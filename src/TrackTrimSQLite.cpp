@@ -4,7 +4,8 @@
 
 #include "TrackTrimSQLite.hpp"
 
-#include <numeric>
+#include <algorithm>
+#include <cmath>
 
 namespace GarfieldSuppl
 {
@@ -13,17 +14,25 @@ namespace GarfieldSuppl
 
     /// Constructor
     TrackTrimSQLite::TrackTrimSQLite()
-        : Track(), m_generator(new TrackGeneratorC())
+        : Track(), m_generator(new Generator())
     {
         m_className = "TrackTrimSQLite";
-        m_generator->SetRandomGenerator(RndmUniform);
+        // Default seed from Garfield's random engine, so that seeding Garfield
+        // still changes (and reproduces) the tracks of every instance
+        const std::uint64_t hi = std::uint64_t(RndmUniform() * 4294967296.) & 0xFFFFFFFFu;
+        const std::uint64_t lo = std::uint64_t(RndmUniform() * 4294967296.) & 0xFFFFFFFFu;
+        m_generator->SetSeed(hi << 32 | lo);
     }
 
     /// Destructor
-    TrackTrimSQLite::~TrackTrimSQLite() {}
+    TrackTrimSQLite::~TrackTrimSQLite()
+    {
+        StopAsyncWorker();
+    }
 
     bool TrackTrimSQLite::ReadFile(const std::string &file)
     {
+        StopAsyncWorker();
         return m_generator->SetFileName(file);
     }
 
@@ -66,6 +75,37 @@ namespace GarfieldSuppl
             return false;
         }
 
+        // Medium map of the drift area (rebuilt when the sensor, the geometry or the area changed)
+        if (m_mediumMapResolution > 0. &&
+            !m_mediumMap.Matches(m_sensor, xmin, ymin, zmin, xmax, ymax, zmax,
+                                 m_mediumMapResolution, m_mediumMapGeometry))
+        {
+            // The background thread reads the map
+            StopAsyncWorker();
+            if (!m_mediumMap.Build(m_sensor, xmin, ymin, zmin, xmax, ymax, zmax,
+                                   m_mediumMapResolution, m_mediumMapGeometry))
+            {
+                std::cerr << hdr << "\n    Medium map could not be built. Disabled.\n";
+                m_mediumMapResolution = 0.;
+            }
+            else
+            {
+                if (!m_mediumMapGeometry && !m_mediumMapWarned)
+                {
+                    std::cerr << hdr << "\n    Medium map built without geometry: solids thinner than "
+                              << m_mediumMapResolution << " cm can be missed.\n"
+                              << "    Pass the geometry to EnableMediumMap for exact queries near solids.\n";
+                    m_mediumMapWarned = true;
+                }
+                if (m_debug)
+                {
+                    std::cout << hdr << "Medium map with " << m_mediumMap.GetNumberOfVoxels()
+                              << " voxels (" << m_mediumMap.GetNumberOfBoundaryVoxels()
+                              << " on boundaries).\n";
+                }
+            }
+        }
+
         // Make sure the initial position is inside an ionisable medium.
         Medium *medium = NULL;
         if (!m_sensor->GetMedium(x0, y0, z0, medium))
@@ -79,20 +119,197 @@ namespace GarfieldSuppl
             return false;
         }
 
+        // Make sure all necessary parameters have been set.
+        if (m_energy < Small)
+        {
+            std::cerr << hdr << "\n    Initial particle energy not set.\n";
+            return false;
+        }
+        else if (m_work < Small)
+        {
+            std::cerr << hdr << "\n    Work function not set.\n";
+            return false;
+        }
+
+        // Steps are tested against the drift area and the homogeneous region first,
+        // so only steps crossing a boundary need a medium query per cluster.
+        if (m_hasHomogeneousRegion)
+        {
+            m_homogeneousSingleMedium = CheckHomogeneousRegion();
+            if (!m_homogeneousSingleMedium)
+                std::cerr << hdr << "\n    Homogeneous region contains several media. Ignored.\n";
+        }
+        const track_settings settings = MakeSettings(x0, y0, z0, t0, dx0, dy0, dz0);
+
+        // Header of debugging output.
+        if (m_debug)
+        {
+            std::cout << hdr << "Track generation with the following parameters:\n";
+            printf("      DB file              %s\n", m_generator->GetFileName().c_str());
+            printf("      Particle kin. energy %g keV\n", settings.ekin);
+            //printf("      Particle mass        %g MeV\n", 1.e-6 * m_mass);
+            printf("      Particle charge      %g\n", m_q);
+            printf("      Work function        %g eV\n", m_work);
+            printf("      Cluster size         %d\n", m_nsize);
+        }
+
+        const std::uint64_t track = m_generator->GetTrackIndex();
+        // Clusters go to the stream during generation unless they are merged afterwards
+        bool streamed = false;
+        if (!IsAsyncEnabled() || !TakeAsyncTrack(settings))
+        {
+            streamed = m_stream && !m_merge;
+            std::vector<pending_cluster> pending;
+            const bool complete = GenerateClusters(settings, *m_generator, m_rng, m_placement,
+                                                   m_clusters, pending,
+                                                   [this](const StepRegion region, const double x,
+                                                          const double y, const double z) {
+                                                       return IsInside(region, x, y, z) ? ClusterTest::Accepted
+                                                                                        : ClusterTest::Rejected;
+                                                   },
+                                                   [this, track, streamed](const std::size_t index, const cluster &c) {
+                                                       if (streamed)
+                                                           PublishCluster(track, index, c);
+                                                   });
+            if (!complete)
+            {
+                std::cerr << hdr << "Exceeded maximum number of clusters.\n";
+            }
+
+            if (IsAsyncEnabled())
+                StartAsyncWorker(settings);
+        }
+
+        m_unmergedClusters = m_clusters.size();
+        if (m_merge)
+            MergeClusters();
+        if (m_stream && !streamed)
+            PublishClusters(track);
+
+        return true;
+        // finished generating
+    }
+
+    void TrackTrimSQLite::PublishCluster(const std::uint64_t track, const std::size_t index,
+                                         const cluster &c)
+    {
+        ClusterStream::Cluster out;
+        out.fX = c.x;
+        out.fY = c.y;
+        out.fZ = c.z;
+        out.fT = c.t;
+        out.fEnergy = c.ec;
+        out.fKinetic = c.kinetic;
+        out.fElectrons = c.electrons;
+        out.fIndex = index;
+        out.fTrack = track;
+        m_stream->Push(out);
+    }
+
+    void TrackTrimSQLite::PublishClusters(const std::uint64_t track)
+    {
+        for (std::size_t i = 0; i < m_clusters.size(); ++i)
+            PublishCluster(track, i, {m_clusters.x[i], m_clusters.y[i], m_clusters.z[i],
+                                      m_clusters.t[i], m_clusters.ec[i], m_clusters.kinetic[i],
+                                      m_clusters.electrons[i]});
+    }
+
+    void TrackTrimSQLite::EnableClusterMerging(const double dx, const double dy, const double dz,
+                                               const double x0, const double y0, const double z0)
+    {
+        m_mergeCell[0] = dx;
+        m_mergeCell[1] = dy;
+        m_mergeCell[2] = dz;
+        m_mergeOrigin[0] = x0;
+        m_mergeOrigin[1] = y0;
+        m_mergeOrigin[2] = z0;
+        m_merge = true;
+    }
+
+    void TrackTrimSQLite::MergeClusters()
+    {
+        const cluster_arrays &c = m_clusters;
+        const std::size_t n = c.size();
+
+        // Cell index along one axis (0 if the axis is not divided)
+        auto cell = [this](const int axis, const double v) -> std::int64_t {
+            const double size = m_mergeCell[axis];
+            return size > 0. ? std::int64_t(std::floor((v - m_mergeOrigin[axis]) / size)) : 0;
+        };
+
+        // Weighted sums of x, y, z, t per cell
+        m_mergeIndex.clear();
+        m_merged.clear();
+        std::vector<double> &weight = m_mergeWeight;
+        weight.clear();
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const voxel_key key = {cell(0, c.x[i]), cell(1, c.y[i]), cell(2, c.z[i])};
+            const auto ins = m_mergeIndex.emplace(key, std::uint32_t(m_merged.size()));
+            // Electron-weighted (a cluster without electrons counts once)
+            const double w = c.electrons[i] > 0 ? c.electrons[i] : 1.;
+            if (ins.second)
+            {
+                m_merged.push_back({w * c.x[i], w * c.y[i], w * c.z[i], w * c.t[i],
+                                    c.ec[i], c.kinetic[i], c.electrons[i]});
+                weight.push_back(w);
+                continue;
+            }
+            const std::uint32_t j = ins.first->second;
+            m_merged.x[j] += w * c.x[i];
+            m_merged.y[j] += w * c.y[i];
+            m_merged.z[j] += w * c.z[i];
+            m_merged.t[j] += w * c.t[i];
+            m_merged.ec[j] += c.ec[i];
+            weight[j] += w;
+            m_merged.electrons[j] += c.electrons[i];
+        }
+
+        for (std::size_t j = 0; j < m_merged.size(); ++j)
+        {
+            const double norm = 1. / weight[j];
+            m_merged.x[j] *= norm;
+            m_merged.y[j] *= norm;
+            m_merged.z[j] *= norm;
+            m_merged.t[j] *= norm;
+        }
+
+        std::swap(m_clusters, m_merged);
+    }
+
+    template <typename Test, typename Publish>
+    bool TrackTrimSQLite::GenerateClusters(const track_settings &s, Generator &generator,
+                                           Mm::CounterRandom &rng, ClusterPlacement &placement,
+                                           cluster_arrays &clusters, std::vector<pending_cluster> &pending,
+                                           Test test, Publish publish) const
+    {
+        const std::string hdr = m_className + "::NewTrack: ";
+
+        clusters.clear();
+        pending.clear();
+
+        // Random streams of this track are keyed by (seed, track index)
+        rng.Reset(s.seed, generator.GetTrackIndex(), m_clusterSubstream);
+
         // Normalise and store the direction.
-        const double normdir = sqrt(dx0 * dx0 + dy0 * dy0 + dz0 * dz0);
-        double xdir = dx0;
-        double ydir = dy0;
-        double zdir = dz0;
+        const double normdir = sqrt(s.dx0 * s.dx0 + s.dy0 * s.dy0 + s.dz0 * s.dz0);
+        double xdir = s.dx0;
+        double ydir = s.dy0;
+        double zdir = s.dz0;
         if (normdir < Small)
         {
-            if (m_debug)
+            if (s.debug)
             {
                 std::cout << hdr << "\n    Direction vector has zero norm.\n"
                           << "    Initial direction is randomized.\n";
             }
             // Null vector. Sample the direction isotropically.
-            RndmDirection(xdir, ydir, zdir);
+            const double ctheta = 1 - 2 * rng.Uniform();
+            const double stheta = sqrt(1 - ctheta * ctheta);
+            const double phi = TwoPi * rng.Uniform();
+            xdir = cos(phi) * stheta;
+            ydir = sin(phi) * stheta;
+            zdir = ctheta;
         }
         else
         {
@@ -102,22 +319,11 @@ namespace GarfieldSuppl
             zdir /= normdir;
         }
 
-        // Make sure all necessary parameters have been set.
-        if (m_energy < Small)
-        {
-            std::cerr << hdr << "\n    Initial particle energy not set.\n";
-            return false;
-        }
-        else if (m_work < Small)
-        {
-            std::cerr << hdr << "\n    Work function not set.\n";
-            return false;
-        }
         // Check the initial energy.
-        const double ekin0 = GetKineticEnergy();
-        if (ekin0 < m_work)
+        const double ekin0 = s.ekin;
+        if (ekin0 < s.work)
         {
-            if (m_debug)
+            if (s.debug)
             {
                 std::cout << hdr << "Initial kinetic energy E = " << ekin0
                           << " eV E < W; particle stopped.\n";
@@ -125,173 +331,463 @@ namespace GarfieldSuppl
             return true;
         }
 
-        // // Get an upper limit for the track length.
-        // const double tracklength = 10 * Interpolate(ekin0, m_ekin, m_range);
-
-        // Header of debugging output.
-        if (m_debug)
+        // Preallocate the clusters: one per W (per nsize electrons) of energy loss at most
+        // (the recoil clusters are usually well within the rounding margin)
         {
-            std::cout << hdr << "Track generation with the following parameters:\n";
-            // const unsigned int nTable = m_ekin.size();
-            printf("      DB file              %s\n", m_generator->GetFileName().c_str());
-            printf("      Particle kin. energy %g keV\n", ekin0);
-            //printf("      Particle mass        %g MeV\n", 1.e-6 * m_mass);
-            printf("      Particle charge      %g\n", m_q);
-            printf("      Work function        %g eV\n", m_work);
-            printf("      Cluster size         %d\n", m_nsize);
+            const int nsize = s.nsize > 0 ? s.nsize : 1;
+            std::size_t nReserve = ekin0 / s.work / nsize + 1;
+            if (s.maxclusters >= 0 && nReserve > std::size_t(s.maxclusters))
+                nReserve = s.maxclusters;
+            clusters.reserve(nReserve);
         }
 
-        // Initial situation: starting position
-        double x = x0;
-        double y = y0;
-        double z = z0;
-
-        // Store the energy [MeV].
-        double e = ekin0;
-        // Total distance covered
-        double dsum = 0.0;
-        // Pool of unused energy
-        double epool = 0.0;
-
-        auto cols = m_generator->Generate(GetKineticEnergy(),
-                                          x0, y0, z0,
-                                          xdir, ydir, zdir);
-
+        // Clusters still to be checked by the caller do not count for the limit
+        auto pushable = [&s, &clusters, &pending]() {
+            return s.maxclusters < 0 || clusters.size() - pending.size() < std::size_t(s.maxclusters);
+        };
+        auto push = [&](const cluster &c, const ClusterTest result) {
+            if (s.debug)
+            {
+                std::cout << hdr << "Cluster " << clusters.size() << "\n    at ("
+                          << c.x << ", " << c.y << ", " << c.z
+                          << "),\n    e = " << c.ec << ",\n    n = "
+                          << c.electrons << ",\n    pool = "
+                          << c.kinetic << " eV.\n";
+            }
+            if (result == ClusterTest::Pending)
+                pending.push_back({std::uint32_t(clusters.size()), 0});
+            else
+                publish(clusters.size(), c);
+            clusters.push_back(c);
+        };
+
+        // Collisions are pulled block by block, so the rest of the track
+        // is never generated once it leaves the drift area or the cluster limit is reached.
+        generator.Begin(ekin0,
+                        s.x0, s.y0, s.z0,
+                        xdir, ydir, zdir);
+
+        const box &area = s.area;
         bool bNClustersReachLimit = false;
+        bool bLeftArea = false;
 
-        for (auto &col : cols)
+        while (!bNClustersReachLimit && !bLeftArea)
         {
+            auto cols = generator.Next(m_collisionBlock);
+            if (cols.empty())
+                break;
 
-            // Cluster generated by recoil ion
-            auto pos_col = col.GetPosition();
-            const double x_col = pos_col.X();
-            const double y_col = pos_col.Y();
-            const double z_col = pos_col.Z();
-            const double ene_incident = col.GetIncidentEnergy();
-            const double ene_recoil = col.GetRecoilEnergy();
-            if (ene_recoil > 0 && IsInside(x_col, y_col, z_col))
+            for (auto &col : cols)
             {
-                cluster cluster_recoil;
-                cluster_recoil.x = x_col;
-                cluster_recoil.y = y_col;
-                cluster_recoil.z = z_col;
-                cluster_recoil.t = t0;
 
-                cluster_recoil.electrons = std::round(ene_recoil / m_work);
-                cluster_recoil.ec = ene_recoil;
-                cluster_recoil.kinetic = ene_incident;
+                auto pos_col = col.GetPosition();
+                const double x_col = pos_col.X();
+                const double y_col = pos_col.Y();
+                const double z_col = pos_col.Z();
 
-                if (NewClusterPushable())
+                // Stop when the ion leaves the drift area (as TrackSrim does).
+                // Same test as Sensor::IsInArea with the area of the sensor.
+                if (!area.Contains(x_col, y_col, z_col))
                 {
+                    if (s.debug)
+                    {
+                        std::cout << hdr << "Particle left the drift area at ("
+                                  << x_col << ", " << y_col << ", " << z_col << ").\n";
+                    }
+                    bLeftArea = true;
+                    break;
+                }
 
-                    if (cluster_recoil.electrons > 0)
+                // Cluster generated by recoil ion
+                const double ene_incident = col.GetIncidentEnergy();
+                const double ene_recoil = col.GetRecoilEnergy();
+                if (ene_recoil > 0)
+                {
+                    const ClusterTest result = test(ClassifyStep(s, x_col, y_col, z_col, 0, 0, 0),
+                                                    x_col, y_col, z_col);
+                    if (result != ClusterTest::Rejected)
                     {
-                        if (m_debug)
+                        cluster cluster_recoil;
+                        cluster_recoil.x = x_col;
+                        cluster_recoil.y = y_col;
+                        cluster_recoil.z = z_col;
+                        cluster_recoil.t = s.t0;
+
+                        cluster_recoil.electrons = std::round(ene_recoil / s.work);
+                        cluster_recoil.ec = ene_recoil;
+                        cluster_recoil.kinetic = ene_incident;
+
+                        if (pushable())
                         {
-                            std::cout << hdr << "Cluster " << m_clusters.size() << "\n    at ("
-                                      << cluster_recoil.x << ", " << cluster_recoil.y << ", " << cluster_recoil.z
-                                      << "),\n    e = " << cluster_recoil.ec << ",\n    n = "
-                                      << cluster_recoil.electrons << ",\n    pool = "
-                                      << cluster_recoil.kinetic << " eV.\n";
+                            if (cluster_recoil.electrons > 0)
+                            {
+                                push(cluster_recoil, result);
+                                if (result == ClusterTest::Pending)
+                                    pending.back().stepEnd = clusters.size();
+                            }
+                        }
+                        else
+                        {
+                            bNClustersReachLimit = true;
+                            break;
                         }
-
-                        m_clusters.push_back(cluster_recoil);
                     }
                 }
-                else
+
+                // Clusters generated during this step
+                double ene_step = ene_incident - ene_recoil;
+
+                const double dr = col.GetDistanceToNextCollision();
+                auto dir_col = col.GetScatteringDirection();
+                const double dir_x_col = dir_col.X();
+                const double dir_y_col = dir_col.Y();
+                const double dir_z_col = dir_col.Z();
+
+                const int nElectrons = std::round(col.GetEnergyLoss() / s.work);
+                const int nClusters = s.nsize < 0 ? nElectrons : std::ceil(nElectrons / s.nsize);
+                if (nClusters == 0 || nElectrons == 0)
+                    continue;
+
+                const int nElectronsInCluster = nElectrons / nClusters;
+                const double eneCluster = std::round(col.GetEnergyLoss() / nClusters);
+
+                if (!s.nonuniform) // -> uniform collision
+                    placement.Even(nClusters);
+                else // non-uniform collision
+                    placement.SortedRandom(rng, nClusters);
+
+                const StepRegion region = ClassifyStep(s, x_col, y_col, z_col,
+                                                       dr * dir_x_col, dr * dir_y_col, dr * dir_z_col);
+                if (region == StepRegion::Outside)
+                    continue;
+
+                placement.Place(x_col, y_col, z_col,
+                                dr * dir_x_col, dr * dir_y_col, dr * dir_z_col);
+                const Span<const double> vClusterX = placement.GetX();
+                const Span<const double> vClusterY = placement.GetY();
+                const Span<const double> vClusterZ = placement.GetZ();
+                const std::size_t firstPending = pending.size();
+
+                for (int iCluster = 0; iCluster < nClusters; ++iCluster)
                 {
-                    bNClustersReachLimit = true;
-                    break;
-                }
-            }
 
-            // Clusters generated during this step
-            double ene_step = ene_incident - ene_recoil;
+                    cluster newcluster;
+                    const double x_cls = vClusterX[iCluster];
+                    const double y_cls = vClusterY[iCluster];
+                    const double z_cls = vClusterZ[iCluster];
 
-            const double dr = col.GetDistanceToNextCollision();
-            auto dir_col = col.GetScatteringDirection();
-            const double dir_x_col = dir_col.X();
-            const double dir_y_col = dir_col.Y();
-            const double dir_z_col = dir_col.Z();
+                    const ClusterTest result = test(region, x_cls, y_cls, z_cls);
+                    if (result == ClusterTest::Rejected)
+                        continue;
 
-            const int nElectrons = std::round(col.GetEnergyLoss() / m_work);
-            const int nClusters = m_nsize < 0 ? nElectrons : std::ceil(nElectrons / m_nsize);
-            if (nClusters == 0 || nElectrons == 0)
-                continue;
+                    newcluster.x = x_cls;
+                    newcluster.y = y_cls;
+                    newcluster.z = z_cls;
+                    newcluster.t = s.t0;
 
-            const int nElectronsInCluster = nElectrons / nClusters;
-            const double eneCluster = std::round(col.GetEnergyLoss() / nClusters);
+                    newcluster.electrons = nElectronsInCluster;
+                    newcluster.ec = eneCluster;
+                    newcluster.kinetic = ene_step;
 
-            const int nDiv = nClusters + 1;
+                    ene_step -= eneCluster;
 
-            std::vector<double> vClusterAt(nClusters);
-            //bool uniform = false;
-            if (!IsNonUniformCollisionEnabled()) // -> uniform collision
-            {
-                std::iota(vClusterAt.begin(), vClusterAt.end(), 1);
-                std::for_each(vClusterAt.begin(), vClusterAt.end(), [&nDiv](auto &_x) { _x /= (double)nDiv; });
-            }
-            else // non-uniform collision
-            {
-                std::for_each(vClusterAt.begin(), vClusterAt.end(), [](auto &_x) { _x = RndmUniform(); });
-                std::sort(vClusterAt.begin(), vClusterAt.end());
+                    if (pushable())
+                    {
+                        push(newcluster, result);
+                    }
+                    else
+                    {
+                        bNClustersReachLimit = true;
+                        break;
+                    }
+                }
+                for (std::size_t i = firstPending; i < pending.size(); ++i)
+                    pending[i].stepEnd = clusters.size();
+                if (bNClustersReachLimit)
+                    break;
             }
+        }
 
-            for (int iCluster = 0; iCluster < nClusters; ++iCluster)
-            {
+        return !bNClustersReachLimit;
+    }
 
-                cluster newcluster;
-                double x_cls, y_cls, z_cls;
-                // x_cls = x_col + dr * dir_x_col * (iCluster + 1) / nDiv;
-                // y_cls = y_col + dr * dir_y_col * (iCluster + 1) / nDiv;
-                // z_cls = z_col + dr * dir_z_col * (iCluster + 1) / nDiv;
+    TrackTrimSQLite::track_settings
+    TrackTrimSQLite::MakeSettings(const double x0, const double y0, const double z0,
+                                  const double t0, const double dx0, const double dy0,
+                                  const double dz0) const
+    {
+        track_settings s;
+        s.x0 = x0;
+        s.y0 = y0;
+        s.z0 = z0;
+        s.t0 = t0;
+        s.dx0 = dx0;
+        s.dy0 = dy0;
+        s.dz0 = dz0;
+        s.ekin = GetKineticEnergy();
+        s.work = m_work;
+        s.nsize = m_nsize;
+        s.maxclusters = m_maxclusters;
+        s.nonuniform = m_nonuniform_collision;
+        s.area = {0., 0., 0., 0., 0., 0.};
+        if (m_sensor)
+            m_sensor->GetArea(s.area.xmin, s.area.ymin, s.area.zmin,
+                              s.area.xmax, s.area.ymax, s.area.zmax);
+        s.hasHomogeneousRegion = m_hasHomogeneousRegion && m_homogeneousSingleMedium;
+        s.homogeneousRegion = m_homogeneousRegion;
+        s.homogeneousIonisable = m_homogeneousIonisable;
+        s.mediumMapResolution = m_mediumMapResolution;
+        s.seed = m_generator->GetSeed();
+        s.transferProbability = m_generator->GetTransferProbability();
+        s.energyMarginRatio = m_generator->GetEnergyMarginRatio();
+        s.debug = m_debug;
+        return s;
+    }
 
-                x_cls = x_col + dr * dir_x_col * vClusterAt.at(iCluster);
-                y_cls = y_col + dr * dir_y_col * vClusterAt.at(iCluster);
-                z_cls = z_col + dr * dir_z_col * vClusterAt.at(iCluster);
+    bool TrackTrimSQLite::track_settings::operator==(const track_settings &o) const
+    {
+        auto sameBox = [](const box &a, const box &b) {
+            return a.xmin == b.xmin && a.ymin == b.ymin && a.zmin == b.zmin &&
+                   a.xmax == b.xmax && a.ymax == b.ymax && a.zmax == b.zmax;
+        };
+        return x0 == o.x0 && y0 == o.y0 && z0 == o.z0 && t0 == o.t0 &&
+               dx0 == o.dx0 && dy0 == o.dy0 && dz0 == o.dz0 &&
+               ekin == o.ekin && work == o.work && nsize == o.nsize &&
+               maxclusters == o.maxclusters && nonuniform == o.nonuniform &&
+               sameBox(area, o.area) &&
+               hasHomogeneousRegion == o.hasHomogeneousRegion &&
+               (!hasHomogeneousRegion ||
+                (sameBox(homogeneousRegion, o.homogeneousRegion) &&
+                 homogeneousIonisable == o.homogeneousIonisable)) &&
+               mediumMapResolution == o.mediumMapResolution &&
+               seed == o.seed && transferProbability == o.transferProbability &&
+               energyMarginRatio == o.energyMarginRatio && debug == o.debug;
+    }
 
-                if (!IsInside(x_cls, y_cls, z_cls))
-                    continue;
+    void TrackTrimSQLite::EnableAsync(const std::size_t depth)
+    {
+        StopAsyncWorker();
+        m_asyncDepth = depth > 0 ? depth : 1;
+    }
+
+    void TrackTrimSQLite::DisableAsync()
+    {
+        StopAsyncWorker();
+        m_asyncDepth = 0;
+        m_asyncQueue.clear();
+        m_asyncSpare.clear();
+    }
+
+    void TrackTrimSQLite::QueueTrack(const double x0, const double y0, const double z0,
+                                     const double t0, const double dx0, const double dy0,
+                                     const double dz0)
+    {
+        // Settings other than the arguments are those of the call, checked again by NewTrack
+        const track_settings s = MakeSettings(x0, y0, z0, t0, dx0, dy0, dz0);
+        std::lock_guard<std::mutex> lock(m_asyncMutex);
+        m_asyncQueue.push_back(s);
+        m_asyncCondition.notify_all();
+    }
 
-                newcluster.x = x_cls;
-                newcluster.y = y_cls;
-                newcluster.z = z_cls;
-                newcluster.t = t0;
+    bool TrackTrimSQLite::TakeAsyncTrack(const track_settings &s)
+    {
+        std::unique_lock<std::mutex> lock(m_asyncMutex);
+        if (!m_asyncThread.joinable())
+            return false;
+        // The worker is never idle while the ring has room
+        m_asyncCondition.wait(lock, [this]() { return !m_asyncRing.empty(); });
 
-                newcluster.electrons = nElectronsInCluster;
-                newcluster.ec = eneCluster;
-                newcluster.kinetic = ene_step;
+        async_track &next = m_asyncRing.front();
+        if (!(next.settings == s) || next.index != m_generator->GetTrackIndex())
+        {
+            lock.unlock();
+            StopAsyncWorker();
+            return false;
+        }
+
+        async_track track = std::move(next);
+        m_asyncRing.pop_front();
+        m_asyncCondition.notify_all();
+        lock.unlock();
 
-                ene_step -= eneCluster;
+        m_generator->SetTrackIndex(track.nextIndex);
 
-                if (NewClusterPushable())
+        const std::string hdr = m_className + "::NewTrack: ";
+        bool complete = track.complete;
+        if (track.pending.empty())
+        {
+            std::swap(m_clusters, track.clusters);
+        }
+        else
+        {
+            // Medium checks the worker left to the sensor, then the cluster limit.
+            // After a rejected cluster, the following ones of its step
+            // take the ion energies of the preceding slots.
+            const cluster_arrays &c = track.clusters;
+            std::size_t iPending = 0;
+            std::size_t slot = 0, shiftEnd = 0;
+            for (std::size_t i = 0; i < c.size(); ++i)
+            {
+                if (i >= shiftEnd)
+                    shiftEnd = 0;
+                if (iPending < track.pending.size() && track.pending[iPending].index == i)
                 {
-                    if (m_debug)
+                    const pending_cluster &p = track.pending[iPending++];
+                    if (!IsInIonisableMedium(c.x[i], c.y[i], c.z[i]))
                     {
-                        std::cout << hdr << "Cluster " << m_clusters.size() << "\n    at ("
-                                  << newcluster.x << ", " << newcluster.y << ", " << newcluster.z
-                                  << "),\n    e = " << newcluster.ec << ",\n    n = "
-                                  << newcluster.electrons << ",\n    pool = "
-                                  << newcluster.kinetic << " eV.\n";
+                        if (shiftEnd == 0)
+                        {
+                            slot = i;
+                            shiftEnd = p.stepEnd;
+                        }
+                        continue;
                     }
-
-                    m_clusters.push_back(newcluster);
                 }
-                else
+                if (s.maxclusters >= 0 && m_clusters.size() >= std::size_t(s.maxclusters))
                 {
-                    bNClustersReachLimit = true;
+                    complete = false;
                     break;
                 }
+                const double kinetic = shiftEnd > 0 ? c.kinetic[slot++] : c.kinetic[i];
+                m_clusters.push_back({c.x[i], c.y[i], c.z[i], c.t[i], c.ec[i], kinetic, c.electrons[i]});
             }
         }
-
-        if (bNClustersReachLimit)
+        if (!complete)
         {
             std::cerr << hdr << "Exceeded maximum number of clusters.\n";
         }
 
+        track.clusters.clear();
+        lock.lock();
+        m_asyncSpare.push_back(std::move(track.clusters));
         return true;
-        // finished generating
+    }
+
+    void TrackTrimSQLite::StartAsyncWorker(const track_settings &s)
+    {
+        StopAsyncWorker();
+        std::unique_ptr<Generator> generator(new Generator(*m_generator));
+        m_asyncStop = false;
+        m_asyncThread = std::thread(&TrackTrimSQLite::RunAsyncWorker, this, s, std::move(generator));
+    }
+
+    void TrackTrimSQLite::StopAsyncWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_asyncMutex);
+            m_asyncStop = true;
+            m_asyncCondition.notify_all();
+        }
+        if (m_asyncThread.joinable())
+            m_asyncThread.join();
+
+        // Parameters taken from the queue go back to it
+        std::lock_guard<std::mutex> lock(m_asyncMutex);
+        for (auto it = m_asyncRing.rbegin(); it != m_asyncRing.rend(); ++it)
+        {
+            if (it->queued)
+                m_asyncQueue.push_front(it->settings);
+            it->clusters.clear();
+            m_asyncSpare.push_back(std::move(it->clusters));
+        }
+        m_asyncRing.clear();
+    }
+
+    void TrackTrimSQLite::RunAsyncWorker(track_settings s, std::unique_ptr<Generator> generator)
+    {
+        Mm::CounterRandom rng;
+        ClusterPlacement placement;
+
+        // Only the medium map and the settings are read, never the sensor
+        auto test = [this, &s](const StepRegion region, const double x,
+                               const double y, const double z) {
+            switch (region)
+            {
+            case StepRegion::Outside:
+                return ClusterTest::Rejected;
+            case StepRegion::Homogeneous:
+                return ClusterTest::Accepted;
+            case StepRegion::Crossing:
+                if (!s.area.Contains(x, y, z))
+                    return ClusterTest::Rejected;
+                break;
+            default:
+                break;
+            }
+            if (s.mediumMapResolution > 0.)
+            {
+                switch (m_mediumMap.GetState(x, y, z))
+                {
+                case MediumVoxelMap::Ionisable:
+                    return ClusterTest::Accepted;
+                case MediumVoxelMap::NotIonisable:
+                    return ClusterTest::Rejected;
+                default:
+                    break;
+                }
+            }
+            return ClusterTest::Pending;
+        };
+
+        try
+        {
+            while (true)
+            {
+                async_track track;
+                {
+                    std::unique_lock<std::mutex> lock(m_asyncMutex);
+                    m_asyncCondition.wait(lock, [this]() {
+                        return m_asyncStop || m_asyncRing.size() < m_asyncDepth;
+                    });
+                    if (m_asyncStop)
+                        return;
+                    track.queued = !m_asyncQueue.empty();
+                    if (track.queued)
+                    {
+                        // Settings from the queue call, the rest from the last track
+                        const track_settings &q = m_asyncQueue.front();
+                        s.x0 = q.x0;
+                        s.y0 = q.y0;
+                        s.z0 = q.z0;
+                        s.t0 = q.t0;
+                        s.dx0 = q.dx0;
+                        s.dy0 = q.dy0;
+                        s.dz0 = q.dz0;
+                        m_asyncQueue.pop_front();
+                    }
+                    if (!m_asyncSpare.empty())
+                    {
+                        track.clusters = std::move(m_asyncSpare.back());
+                        m_asyncSpare.pop_back();
+                    }
+                }
+
+                track.settings = s;
+                track.index = generator->GetTrackIndex();
+                track.complete = GenerateClusters(s, *generator, rng, placement,
+                                                  track.clusters, track.pending, test,
+                                                  [](const std::size_t, const cluster &) {});
+                track.nextIndex = generator->GetTrackIndex();
+
+                std::lock_guard<std::mutex> lock(m_asyncMutex);
+                m_asyncRing.push_back(std::move(track));
+                m_asyncCondition.notify_all();
+            }
+        }
+        catch (const std::exception &e)
+        {
+            // NewTrack does not find a matching track and generates it again in place
+            std::cerr << m_className << "::NewTrack: Background generation stopped ("
+                      << e.what() << ").\n";
+            std::lock_guard<std::mutex> lock(m_asyncMutex);
+            async_track failed;
+            failed.settings = s;
+            failed.queued = false;
+            failed.index = failed.nextIndex = ~std::uint64_t(0);
+            failed.complete = false;
+            m_asyncRing.push_back(std::move(failed));
+            m_asyncCondition.notify_all();
+        }
     }
 
     bool TrackTrimSQLite::GetCluster(double &xcls, double &ycls, double &zcls,
@@ -307,24 +803,162 @@ namespace GarfieldSuppl
         if (m_currcluster >= m_clusters.size())
             return false;
 
-        xcls = m_clusters[m_currcluster].x;
-        ycls = m_clusters[m_currcluster].y;
-        zcls = m_clusters[m_currcluster].z;
-        tcls = m_clusters[m_currcluster].t;
+        xcls = m_clusters.x[m_currcluster];
+        ycls = m_clusters.y[m_currcluster];
+        zcls = m_clusters.z[m_currcluster];
+        tcls = m_clusters.t[m_currcluster];
 
-        n = m_clusters[m_currcluster].electrons;
-        e = m_clusters[m_currcluster].ec;
-        extra = m_clusters[m_currcluster].kinetic;
+        n = m_clusters.electrons[m_currcluster];
+        e = m_clusters.ec[m_currcluster];
+        extra = m_clusters.kinetic[m_currcluster];
         // Move to next cluster
         ++m_currcluster;
         return true;
     }
 
+    bool TrackTrimSQLite::box::IntersectsSegment(const double x, const double y, const double z,
+                                                 const double dx, const double dy, const double dz) const
+    {
+        double tmin = 0., tmax = 1.;
+        const double p[3] = {x, y, z};
+        const double d[3] = {dx, dy, dz};
+        const double lo[3] = {xmin, ymin, zmin};
+        const double hi[3] = {xmax, ymax, zmax};
+        for (int i = 0; i < 3; ++i)
+        {
+            if (d[i] == 0)
+            {
+                if (p[i] < lo[i] || p[i] > hi[i])
+                    return false;
+                continue;
+            }
+            double t0 = (lo[i] - p[i]) / d[i];
+            double t1 = (hi[i] - p[i]) / d[i];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+            if (tmin > tmax)
+                return false;
+        }
+        return true;
+    }
+
+    TrackTrimSQLite::StepRegion TrackTrimSQLite::ClassifyStep(const track_settings &s,
+                                                              const double x, const double y, const double z,
+                                                              const double dx, const double dy, const double dz)
+    {
+        if (!s.area.IntersectsSegment(x, y, z, dx, dy, dz))
+            return StepRegion::Outside;
+        if (!s.area.ContainsSegment(x, y, z, dx, dy, dz))
+            return StepRegion::Crossing;
+        if (s.hasHomogeneousRegion &&
+            s.homogeneousRegion.ContainsSegment(x, y, z, dx, dy, dz))
+            return s.homogeneousIonisable ? StepRegion::Homogeneous : StepRegion::Outside;
+        return StepRegion::Inside;
+    }
+
+    TrackTrimSQLite::cluster_spans TrackTrimSQLite::GetClusters() const
+    {
+        cluster_spans ret;
+        ret.x = m_clusters.x;
+        ret.y = m_clusters.y;
+        ret.z = m_clusters.z;
+        ret.t = m_clusters.t;
+        ret.ec = m_clusters.ec;
+        ret.kinetic = m_clusters.kinetic;
+        ret.electrons = m_clusters.electrons;
+        return ret;
+    }
+
+    void TrackTrimSQLite::cluster_arrays::clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        t.clear();
+        ec.clear();
+        kinetic.clear();
+        electrons.clear();
+    }
+
+    void TrackTrimSQLite::cluster_arrays::reserve(const std::size_t n)
+    {
+        x.reserve(n);
+        y.reserve(n);
+        z.reserve(n);
+        t.reserve(n);
+        ec.reserve(n);
+        kinetic.reserve(n);
+        electrons.reserve(n);
+    }
+
+    void TrackTrimSQLite::cluster_arrays::push_back(const cluster &c)
+    {
+        x.push_back(c.x);
+        y.push_back(c.y);
+        z.push_back(c.z);
+        t.push_back(c.t);
+        ec.push_back(c.ec);
+        kinetic.push_back(c.kinetic);
+        electrons.push_back(c.electrons);
+    }
+
     bool TrackTrimSQLite::IsInside(const double x, const double y, const double z)
     {
+        // Check that the cluster is in an ionisable medium and within bounding box
+        if (!IsInIonisableMedium(x, y, z))
+        {
+            return false;
+        }
+        else if (!m_sensor->IsInArea(x, y, z))
+        {
+            if (m_debug)
+            {
+                std::cout << "Cluster at ("
+                          << x << "," << y << "," << z << ") outside bounding box.\n";
+            }
+            return false;
+        }
+        return true;
+    }
+
+    bool TrackTrimSQLite::CheckHomogeneousRegion()
+    {
+        const box &r = m_homogeneousRegion;
+        auto getMedium = [this](const double x, const double y, const double z) {
+            Medium *medium = nullptr;
+            if (!m_sensor->GetMedium(x, y, z, medium))
+                return static_cast<Medium *>(nullptr);
+            return medium;
+        };
+        Medium *medium = getMedium(0.5 * (r.xmin + r.xmax), 0.5 * (r.ymin + r.ymax), 0.5 * (r.zmin + r.zmax));
+        for (int i = 0; i < 8; ++i)
+        {
+            if (getMedium(i & 1 ? r.xmax : r.xmin, i & 2 ? r.ymax : r.ymin, i & 4 ? r.zmax : r.zmin) != medium)
+                return false;
+        }
+        m_homogeneousIonisable = medium && medium->IsIonisable();
+        return true;
+    }
+
+    bool TrackTrimSQLite::IsInIonisableMedium(const double x, const double y, const double z)
+    {
+        if (m_mediumMapResolution > 0.)
+        {
+            switch (m_mediumMap.GetState(x, y, z))
+            {
+            case MediumVoxelMap::Ionisable:
+                return true;
+            case MediumVoxelMap::NotIonisable:
+                return false;
+            default: // exact query
+                break;
+            }
+        }
+
         Medium *medium = NULL;
 
-        // Check that the cluster is in an ionisable medium and within bounding box
         if (!m_sensor->GetMedium(x, y, z, medium))
         {
             if (m_debug)
@@ -343,15 +977,6 @@ namespace GarfieldSuppl
             }
             return false;
         }
-        else if (!m_sensor->IsInArea(x, y, z))
-        {
-            if (m_debug)
-            {
-                std::cout << "Cluster at ("
-                          << x << "," << y << "," << z << ") outside bounding box.\n";
-            }
-            return false;
-        }
         return true;
     }
 
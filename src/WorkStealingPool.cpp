@@ -0,0 +1,144 @@
+#include "WorkStealingPool.hpp"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    // Index range owned by one worker
+    class Range
+    {
+    public:
+        Range() : fBegin(0), fEnd(0){};
+
+        void Set(std::size_t _begin, std::size_t _end)
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fBegin = _begin;
+            fEnd = _end;
+        }
+
+        // Owner takes the next index from the front
+        bool PopFront(std::size_t &_i)
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (fBegin >= fEnd)
+                return false;
+            _i = fBegin++;
+            return true;
+        }
+
+        // Thief takes the back half
+        bool StealHalf(std::size_t &_begin, std::size_t &_end)
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (fBegin >= fEnd)
+                return false;
+            std::size_t n = fEnd - fBegin;
+            _end = fEnd;
+            _begin = fEnd - (n + 1) / 2;
+            fEnd = _begin;
+            return true;
+        }
+
+        std::size_t Size()
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            return fEnd - fBegin;
+        }
+
+    private:
+        std::mutex fMutex;
+        std::size_t fBegin, fEnd;
+    };
+}
+
+WorkStealingPool::WorkStealingPool(int _nThreads)
+    : fNumberOfThreads(_nThreads)
+{
+    if (fNumberOfThreads <= 0)
+        fNumberOfThreads = std::thread::hardware_concurrency();
+    if (fNumberOfThreads <= 0)
+        fNumberOfThreads = 1;
+}
+
+void WorkStealingPool::Run(std::size_t _n,
+                           const std::function<void(int, std::size_t)> &_task)
+{
+    if (_n == 0)
+        return;
+
+    const int nWorkers = fNumberOfThreads < (int)_n ? fNumberOfThreads : (int)_n;
+
+    if (nWorkers == 1)
+    {
+        for (std::size_t i = 0; i < _n; ++i)
+            _task(0, i);
+        return;
+    }
+
+    std::unique_ptr<Range[]> ranges(new Range[nWorkers]);
+    for (int iWorker = 0; iWorker < nWorkers; ++iWorker)
+    {
+        ranges[iWorker].Set(_n * iWorker / nWorkers, _n * (iWorker + 1) / nWorkers);
+    }
+
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto work = [&](int _worker) {
+        try
+        {
+            while (!failed)
+            {
+                std::size_t i;
+                if (ranges[_worker].PopFront(i))
+                {
+                    _task(_worker, i);
+                    continue;
+                }
+
+                // Own range exhausted -> steal from the largest remaining range
+                int victim = -1;
+                std::size_t largest = 0;
+                for (int iWorker = 0; iWorker < nWorkers; ++iWorker)
+                {
+                    std::size_t size = ranges[iWorker].Size();
+                    if (size > largest)
+                    {
+                        largest = size;
+                        victim = iWorker;
+                    }
+                }
+                if (victim < 0)
+                    break;
+
+                std::size_t begin, end;
+                if (ranges[victim].StealHalf(begin, end))
+                    ranges[_worker].Set(begin, end);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nWorkers - 1);
+    for (int iWorker = 1; iWorker < nWorkers; ++iWorker)
+        threads.emplace_back(work, iWorker);
+    work(0);
+    for (auto &th : threads)
+        th.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -18,6 +18,7 @@
 #include "Random.hh"
 
 #include "TrackTrimSQLite.hpp"
+#include "TrackTreeFile.hpp"
 
 int main()
 {
@@ -54,19 +55,12 @@ int main()
     // track->EnableDebugging();
 
     //value for Tree
-    std::vector<double> vx, vy, vz, vt;
-    std::vector<int> vn;
-    std::vector<double> ve_cls, ve_ion;
+    // (ParallelTreeWriter<ClusterTreeEntry> writes the same tree from several threads)
+    ClusterTreeEntry entry;
 
     TFile fOut("tracktrim_new.root", "recreate");
     TTree tr("tr", "");
-    tr.Branch("x", &vx);
-    tr.Branch("y", &vy);
-    tr.Branch("z", &vz);
-    tr.Branch("t", &vt);
-    tr.Branch("n", &vn);
-    tr.Branch("e_cls", &ve_cls);
-    tr.Branch("e_ion", &ve_ion);
+    entry.Branch(tr);
 
     for (int iTrack = 0; iTrack < 1000; ++iTrack)
     {
@@ -74,28 +68,7 @@ int main()
         std::cout << " " << iTrack << std::endl;
         track->NewTrack(0, 0, 0, 0, 1, 0, 0);
 
-        double xc, yc, zc, tc;
-        int ne_c;
-        double e_cls, e_ion;
-
-        vx.clear();
-        vy.clear();
-        vz.clear();
-        vt.clear();
-        vn.clear();
-        ve_cls.clear();
-        ve_ion.clear();
-
-        while (track->GetCluster(xc, yc, zc, tc, ne_c, e_cls, e_ion))
-        {
-            vx.push_back(xc);
-            vy.push_back(yc);
-            vz.push_back(zc);
-            vt.push_back(tc);
-            vn.push_back(ne_c);
-            ve_cls.push_back(e_cls);
-            ve_ion.push_back(e_ion);
-        }
+        entry.Assign(track->GetClusters());
 
         tr.Fill();
     }